@@ -0,0 +1,47 @@
+#include "AdaptiveConcurrency.h"
+
+AdaptiveConcurrency::AdaptiveConcurrency(int maximum)
+    : maximum_(qMax(maximum, 1)), limit_(maximum_), successes_(0), nextTicket_(0), decreasedAt_(0) {
+}
+
+void AdaptiveConcurrency::setMaximum(int maximum) {
+    maximum = qMax(maximum, 1);
+    if (maximum == maximum_)
+        return;
+
+    // A higher maximum is reached by growing into it; a lower one applies now
+    maximum_ = maximum;
+    limit_ = qMin(limit_, maximum_);
+    successes_ = 0;
+}
+
+int AdaptiveConcurrency::maximum() const {
+    return maximum_;
+}
+
+int AdaptiveConcurrency::limit() const {
+    return limit_;
+}
+
+quint64 AdaptiveConcurrency::started() {
+    return nextTicket_++;
+}
+
+void AdaptiveConcurrency::success() {
+    if (limit_ >= maximum_)
+        return;
+
+    if (++successes_ >= limit_) {
+        limit_++;
+        successes_ = 0;
+    }
+}
+
+void AdaptiveConcurrency::congestion(quint64 ticket) {
+    if (ticket < decreasedAt_)
+        return; // Sent at the old limit, which was already halved
+
+    limit_ = qMax(limit_ / 2, 1);
+    successes_ = 0;
+    decreasedAt_ = nextTicket_;
+}
@@ -0,0 +1,37 @@
+#ifndef ADAPTIVECONCURRENCY_H
+#define ADAPTIVECONCURRENCY_H
+
+#include <QtGlobal>
+
+/**
+ * How many requests to keep in flight to a server that may be slower (or
+ * more rate limited) than configured. Additive increase, multiplicative
+ * decrease, as TCP does: the limit grows by one for every `limit` requests
+ * that succeed, up to the maximum, and halves when the server pushes back
+ * (HTTP 429, 5xx, a timeout). Requests that were already in flight when the
+ * limit was halved don't halve it again, so one overloaded moment costs one
+ * decrease and not one per parallel request.
+ */
+class AdaptiveConcurrency {
+public:
+    explicit AdaptiveConcurrency(int maximum = 1);
+
+    // Changes the maximum, keeping what was learned below it
+    void setMaximum(int maximum);
+    int maximum() const;
+    int limit() const;
+
+    // A request is sent; returns its ticket for success() and congestion()
+    quint64 started();
+    void success();
+    void congestion(quint64 ticket);
+
+private:
+    int maximum_;
+    int limit_;
+    int successes_;          // Since the limit last changed
+    quint64 nextTicket_;
+    quint64 decreasedAt_;    // First ticket sent after the last decrease
+};
+
+#endif // ADAPTIVECONCURRENCY_H
@@ -0,0 +1,62 @@
+#include "ArchiveEntries.h"
+#include <QFileInfo>
+#include <QStringList>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+namespace translateLocally {
+
+bool storeUncompressed(const QString &name) {
+    static const QStringList compressedSuffixes = {
+        "jpg", "jpeg", "png", "gif", "webp", "mp3", "m4a", "mp4", "ogg", "woff", "woff2", "zip"
+    };
+    return name == "mimetype" || compressedSuffixes.contains(QFileInfo(name).suffix().toLower());
+}
+
+bool writeEntryHeader(struct archive *writer, struct archive_entry *entry) {
+    const char *compression = storeUncompressed(QString::fromUtf8(archive_entry_pathname(entry))) ? "store" : "deflate";
+    archive_write_set_format_option(writer, "zip", "compression", compression);
+    return archive_write_header(writer, entry) == ARCHIVE_OK;
+}
+
+bool writeEntry(struct archive *writer, struct archive_entry *entry, const QByteArray &content) {
+    archive_entry_set_size(entry, content.size());
+    return writeEntryHeader(writer, entry) &&
+           archive_write_data(writer, content.constData(), content.size()) == content.size();
+}
+
+bool readEntryData(struct archive *reader, QByteArray &content) {
+    const void *block;
+    size_t size;
+    la_int64_t offset;
+    int r;
+    while ((r = archive_read_data_block(reader, &block, &size, &offset)) == ARCHIVE_OK) {
+        content.append(static_cast<const char *>(block), static_cast<int>(size));
+    }
+    return r == ARCHIVE_EOF;
+}
+
+bool copyEntry(struct archive *reader, struct archive *writer, struct archive_entry *entry) {
+    if (!writeEntryHeader(writer, entry))
+        return false;
+
+    const void *block;
+    size_t size;
+    la_int64_t offset;
+    int r;
+    while ((r = archive_read_data_block(reader, &block, &size, &offset)) == ARCHIVE_OK) {
+        if (archive_write_data(writer, block, size) != static_cast<la_ssize_t>(size))
+            return false;
+    }
+    return r == ARCHIVE_EOF;
+}
+
+QString archiveError(struct archive *reader, struct archive *writer) {
+    const char *message = archive_error_string(writer);
+    if (!message)
+        message = archive_error_string(reader);
+    return message ? QString::fromUtf8(message) : QString("unknown error");
+}
+
+} // namespace translateLocally
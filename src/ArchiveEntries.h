@@ -0,0 +1,39 @@
+#ifndef ARCHIVEENTRIES_H
+#define ARCHIVEENTRIES_H
+
+#include <QByteArray>
+#include <QString>
+
+struct archive;
+struct archive_entry;
+
+/**
+ * Helpers for rewriting ZIP based documents (DOCX, EPUB, ODT...) with
+ * libarchive: entries are read from the original and written to a new archive,
+ * either copied as they are or with new content.
+ */
+namespace translateLocally {
+
+// Entries that are stored rather than deflated: the EPUB and ODF mimetype
+// file must be, and already compressed media doesn't get any smaller.
+bool storeUncompressed(const QString &name);
+
+// Writes the header of `entry`, choosing its compression from its name.
+bool writeEntryHeader(struct archive *writer, struct archive_entry *entry);
+
+// Writes `entry` with `content` as its data.
+bool writeEntry(struct archive *writer, struct archive_entry *entry, const QByteArray &content);
+
+// Appends the data of the current entry of `reader` to `content`.
+bool readEntryData(struct archive *reader, QByteArray &content);
+
+// Copies the current entry of `reader` a block at a time, so large media never
+// has to be held in memory as a whole.
+bool copyEntry(struct archive *reader, struct archive *writer, struct archive_entry *entry);
+
+// Error message of whichever of the two archives has one.
+QString archiveError(struct archive *reader, struct archive *writer);
+
+} // namespace translateLocally
+
+#endif // ARCHIVEENTRIES_H
@@ -0,0 +1,41 @@
+#include "DocumentFormat.h"
+#include "formats/PackageFormat.h"
+#include "formats/HtmlFormat.h"
+#include "formats/SubtitleFormat.h"
+#include <QFileInfo>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// All handlers. New formats are added here.
+const std::vector<std::unique_ptr<DocumentFormat>> &formats() {
+    static const std::vector<std::unique_ptr<DocumentFormat>> handlers = []() {
+        std::vector<std::unique_ptr<DocumentFormat>> list;
+        list.push_back(PackageFormat::odt());
+        list.push_back(PackageFormat::pptx());
+        list.push_back(PackageFormat::xlsx());
+        list.push_back(std::make_unique<HtmlFormat>());
+        list.push_back(std::make_unique<SubtitleFormat>());
+        return list;
+    }();
+    return handlers;
+}
+
+} // namespace
+
+const DocumentFormat *DocumentFormat::forPath(const QString &path) {
+    QString suffix = QFileInfo(path).suffix().toLower();
+    for (const auto &format : formats()) {
+        if (format->suffixes().contains(suffix))
+            return format.get();
+    }
+    return nullptr;
+}
+
+QStringList DocumentFormat::supportedSuffixes() {
+    QStringList suffixes;
+    for (const auto &format : formats())
+        suffixes += format->suffixes();
+    return suffixes;
+}
@@ -0,0 +1,52 @@
+#ifndef DOCUMENTFORMAT_H
+#define DOCUMENTFORMAT_H
+
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+#include <QVector>
+#include <functional>
+
+/**
+ * Handler for a document format that DocumentSplitter and DocumentMerger
+ * support without special code: it extracts the translatable units of a
+ * document (paragraphs, slide texts, spreadsheet strings, subtitle cues...)
+ * and writes a copy of the document with those units replaced.
+ *
+ * A unit's id is its position in the order extract() reports them, so
+ * rewrite() has to walk the document the same way. Handlers are stateless
+ * and looked up by file suffix.
+ */
+class DocumentFormat {
+public:
+    using UnitCallback = std::function<void(QStringView text)>;
+
+    virtual ~DocumentFormat() = default;
+
+    // Short name for messages, e.g. "ODT"
+    virtual QString name() const = 0;
+
+    // Lower case file suffixes this handler reads and writes
+    virtual QStringList suffixes() const = 0;
+
+    // Units are the inner HTML of an element rather than plain text, so
+    // they are translated in HTML mode.
+    virtual bool html() const { return false; }
+
+    // Calls `unit` for every unit of `path`, in document order. Units may be
+    // empty, but never contain a newline.
+    virtual bool extract(const QString &path, const UnitCallback &unit, QString *errorMessage = nullptr) const = 0;
+
+    // Writes `path` to `outputPath` with the text of unit i replaced by
+    // translations[i]. Units with a null translation, or none, are kept.
+    virtual bool rewrite(const QString &path, const QVector<QString> &translations, const QString &outputPath,
+                         QString *errorMessage = nullptr) const = 0;
+
+    // The handler for the suffix of `path`, or nullptr.
+    static const DocumentFormat *forPath(const QString &path);
+
+    // Suffixes of all handlers
+    static QStringList supportedSuffixes();
+};
+
+#endif // DOCUMENTFORMAT_H
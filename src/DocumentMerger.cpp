@@ -1,4 +1,5 @@
 #include "DocumentMerger.h"
+#include <QBuffer>
 #include <QFile>
 #include <QFileInfo>
 #include <QDebug>
@@ -8,13 +9,115 @@
 #include <QDir>
 #include <QTextStream>
 #include <QMap>
+#include <QHash>
 #include <QRegularExpression>
+#include <QThreadPool>
+#include <future>
+#include <deque>
+#include <algorithm>
+#include "PooledTask.h"
+#include "ArchiveEntries.h"
+#include "DocumentFormat.h"
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#ifdef HAVE_POPPLER
+#include <poppler-document.h>
+#include <poppler-page.h>
+#include <QGuiApplication>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QPageSize>
+#include <memory>
+#include "PdfLayout.h"
+#endif
+
+namespace {
+
+// The translation service writes HTML, not XHTML: void elements are not
+// closed. Returns `html` as a well-formed XHTML fragment, or its text content
+// if it can't be made into one.
+QString toXhtmlFragment(const QString &html) {
+    static const QRegularExpression voidElement(
+        "<(area|base|br|col|embed|hr|img|input|link|meta|source|track|wbr)\\b([^>]*?)\\s*/?>",
+        QRegularExpression::CaseInsensitiveOption);
+    QString fragment = html;
+    fragment.replace(voidElement, "<\\1\\2/>");
+
+    QXmlStreamReader check("<x>" + fragment + "</x>");
+    check.setNamespaceProcessing(false);
+    while (!check.atEnd())
+        check.readNext();
+    if (!check.hasError())
+        return fragment;
+
+    static const QRegularExpression tag("<[^>]+>");
+    return QString(fragment).remove(tag).toHtmlEscaped();
+}
+
+// Translations indexed by paragraph id. Ids without a translation hold a null
+// string: the original text is kept for them.
+QVector<QString> translationsById(const QList<DocumentSplitter::Segment> &segments) {
+    int size = 0;
+    for (const auto &seg : segments) {
+        for (const auto &para : seg.paragraphs)
+            size = std::max(size, para.id + 1);
+    }
+
+    QVector<QString> translations(size);
+    for (const auto &seg : segments) {
+        for (const auto &para : seg.paragraphs)
+            translations[para.id] = para.text.isNull() ? QString("") : para.text;
+    }
+    return translations;
+}
+
+} // namespace
+
+// State of openStream(). For EPUB, the original is read once more alongside
+// the output: entries are copied up to the chapter whose translation is
+// complete, which is then rewritten.
+struct DocumentMerger::Stream {
+    bool epub = false;
+    QString outputPath;
+    bool first = true;
+
+    // TXT
+    QFile file;
+
+    // EPUB
+    struct archive *reader = nullptr;
+    struct archive *writer = nullptr;
+    QString chapter;                // Entry the translations below belong to
+    QVector<QString> translations;  // By paragraph id
+
+#ifdef HAVE_POPPLER
+    // PDF read by Poppler: a page is written once the translations of all
+    // its blocks are in. Written as PDF, or as HTML to `file`.
+    bool pdf = false;
+    std::unique_ptr<poppler::document> document;
+    int pages = 0;
+    int nextPage = 0;
+    int nextBlock = 0;                  // Id of the first block of nextPage
+    std::unique_ptr<PdfLayout::Page> layout; // Of nextPage, once read
+    QHash<int, QString> blocks;         // Translations by block id, not written yet
+    std::unique_ptr<QPdfWriter> pdfWriter;
+    std::unique_ptr<QPainter> painter;  // Goes before pdfWriter
+#endif
+
+    ~Stream() {
+        if (reader)
+            archive_read_free(reader);
+        if (writer)
+            archive_write_free(writer);
+    }
+};
+
 DocumentMerger::DocumentMerger(QObject *parent) : QObject(parent) {}
 
+DocumentMerger::~DocumentMerger() = default;
+
 bool DocumentMerger::mergeToTxt(const QList<DocumentSplitter::Segment> &translatedSegments,
                                  const QString &outputPath) {
     QFile file(outputPath);
@@ -37,7 +140,7 @@ bool DocumentMerger::mergeToTxt(const QList<DocumentSplitter::Segment> &translat
     });
 
     for (int i = 0; i < sorted.size(); i++) {
-        out << sorted[i].text;
+        out << sorted[i].text();
         if (i < sorted.size() - 1) {
             out << "\n";
         }
@@ -55,88 +158,135 @@ bool DocumentMerger::mergeToDocx(const QString &originalDocxPath,
                                   const QString &outputPath) {
     Q_UNUSED(originalSegments);
 
-    // Concatenate all translated segments
-    QList<DocumentSplitter::Segment> sorted = translatedSegments;
-    std::sort(sorted.begin(), sorted.end(), [](const DocumentSplitter::Segment &a, const DocumentSplitter::Segment &b) {
-        return a.index < b.index;
-    });
-
-    QString fullTranslation;
-    for (const auto &seg : sorted) {
-        fullTranslation += seg.text + "\n";
-    }
-
-    return rebuildDocxWithTranslation(originalDocxPath, fullTranslation.trimmed(), outputPath);
+    return rebuildDocxWithTranslation(originalDocxPath, translationsById(translatedSegments), outputPath);
 }
 
-QString DocumentMerger::replaceTextInWordXml(const QString &originalXml, const QString &translatedText) {
-    // PARAGRAPH-BY-PARAGRAPH: Preserve paragraph structure and properties
-    // Put translated text in first <w:t>, keep paragraph formatting
-
-    if (translatedText.trimmed().isEmpty()) {
-        return originalXml;
+bool DocumentMerger::replaceTextInWordXml(struct archive *reader, struct archive *writer, struct archive_entry *entry,
+                                          const QVector<QString> &translatedParas, QString *xmlError) {
+    // PARAGRAPH-BY-PARAGRAPH: Preserve paragraph structure and properties.
+    // Single streaming pass: every token is copied from reader to writer,
+    // except the text of <w:t> elements. The first non-empty <w:t> of each
+    // paragraph receives that paragraph's translation, later ones in the same
+    // paragraph are emptied. Runs and their properties all stay in place.
+    // Paragraph ids are counted as DocumentSplitter::splitDocx() does: a
+    // paragraph is the non-empty <w:t> text seen since the last </w:p>.
+    if (translatedParas.isEmpty()) {
+        return translateLocally::copyEntry(reader, writer, entry);
     }
 
-    // Split translated text by newlines (one line = one paragraph from DocumentSplitter)
-    QStringList translatedParas = translatedText.split('\n', Qt::SkipEmptyParts);
-    int transIndex = 0;
-
-    QString result = originalXml;
-
-    // Find all paragraphs with text content
-    QRegularExpression paraPattern("<w:p(\\s[^>]*)?>.*?</w:p>", QRegularExpression::DotMatchesEverythingOption);
-    QRegularExpressionMatchIterator paraIt = paraPattern.globalMatch(originalXml);
-
-    QVector<QPair<int, int>> replacements; // positions
-    QStringList newParas;
+    // The XML is parsed while it is decompressed, as in splitDocx(), and what
+    // has been written is passed on to the archive after every block, so
+    // neither document is ever held as a whole. Its new size is not known
+    // until the end.
+    archive_entry_unset_size(entry);
+    if (!translateLocally::writeEntryHeader(writer, entry))
+        return false;
 
-    while (paraIt.hasNext()) {
-        QRegularExpressionMatch paraMatch = paraIt.next();
-        QString originalPara = paraMatch.captured(0);
+    // No namespace processing, so prefixes and namespace declarations are
+    // copied exactly as written.
+    QXmlStreamReader xml;
+    xml.setNamespaceProcessing(false);
+    QBuffer output;
+    output.open(QIODevice::WriteOnly);
+    QXmlStreamWriter out(&output);
+
+    int paraId = 0;
+    bool paraSeen = false;
+    bool paraTranslated = false;
+
+    // A <w:t> is written once its end is seen: its text may be split
+    // over blocks.
+    bool inText = false;
+    QString textName;
+    QXmlStreamAttributes textAttrs;
+    QString text;
+
+    const void *block;
+    size_t size;
+    la_int64_t offset;
+    int r;
+    while ((r = archive_read_data_block(reader, &block, &size, &offset)) == ARCHIVE_OK) {
+        xml.addData(QByteArray::fromRawData(static_cast<const char *>(block), static_cast<int>(size)));
+
+        // Running out of data is expected until the last block
+        while (!xml.atEnd()) {
+            xml.readNext();
+
+            if (inText) {
+                if (xml.isCharacters()) {
+                    text += xml.text();
+                } else if (xml.isEndElement()) {
+                    inText = false;
+                    if (!text.isEmpty() && !paraSeen) {
+                        paraSeen = true;
+                        if (paraId < translatedParas.size() && !translatedParas[paraId].isNull()) {
+                            text = translatedParas[paraId];
+                            paraTranslated = true;
+                            // Leading/trailing spaces of the translation are meaningful
+                            for (int i = textAttrs.size() - 1; i >= 0; --i) {
+                                if (textAttrs[i].qualifiedName() == QLatin1String("xml:space"))
+                                    textAttrs.remove(i);
+                            }
+                            textAttrs.append("xml:space", "preserve");
+                        }
+                        paraId++;
+                    } else if (paraTranslated) {
+                        text.clear();
+                    }
 
-        // Check if paragraph has text content
-        QRegularExpression wtPattern("<w:t[^>]*>([^<]+)</w:t>");
-        if (!wtPattern.match(originalPara).hasMatch()) {
-            continue; // Skip paragraphs without text (e.g., just properties/formatting)
+                    out.writeStartElement(textName);
+                    out.writeAttributes(textAttrs);
+                    out.writeCharacters(text);
+                    out.writeEndElement();
+                }
+            } else if (xml.isStartElement() && xml.qualifiedName() == QLatin1String("w:t")) {
+                inText = true;
+                textName = xml.qualifiedName().toString();
+                textAttrs = xml.attributes();
+                text.clear();
+            } else if (xml.isStartElement()) {
+                // Not writeCurrentToken(): without namespace processing that
+                // would drop the prefix from the element name.
+                out.writeStartElement(xml.qualifiedName().toString());
+                out.writeAttributes(xml.attributes());
+            } else if (xml.isEndElement()) {
+                out.writeEndElement();
+                if (xml.qualifiedName() == QLatin1String("w:p"))
+                    paraSeen = paraTranslated = false;
+            } else if (!xml.hasError()) {
+                out.writeCurrentToken(xml);
+            }
         }
 
-        // Get next translated paragraph
-        if (transIndex >= translatedParas.size()) {
-            break; // No more translations
-        }
-        QString transPara = translatedParas[transIndex++];
-
-        // Replace: keep paragraph structure, put translated text in FIRST <w:t>, remove others
-        QString newPara = originalPara;
-
-        // Find first <w:t> and replace its content
-        QRegularExpressionMatch firstWt = wtPattern.match(newPara);
-        if (firstWt.hasMatch()) {
-            QString newWt = QString("<w:t xml:space=\"preserve\">%1</w:t>").arg(transPara.toHtmlEscaped());
-            newPara.replace(firstWt.capturedStart(), firstWt.capturedLength(), newWt);
-
-            // Remove all subsequent <w:t> nodes in this paragraph
-            QRegularExpression allWtPattern("<w:t[^>]*>[^<]*</w:t>");
-            int offset = firstWt.capturedStart() + newWt.length();
-            QString afterFirst = newPara.mid(offset);
-            afterFirst.replace(allWtPattern, "");
-            newPara = newPara.left(offset) + afterFirst;
-        }
+        if (xml.hasError() && xml.error() != QXmlStreamReader::PrematureEndOfDocumentError)
+            break;
 
-        replacements.append(qMakePair(paraMatch.capturedStart(), paraMatch.capturedLength()));
-        newParas.append(newPara);
+        if (archive_write_data(writer, output.data().constData(), output.size()) != output.size())
+            return false;
+        output.buffer().clear();
+        output.seek(0);
     }
 
-    // Replace in reverse order to maintain positions
-    for (int i = replacements.size() - 1; i >= 0; i--) {
-        result.replace(replacements[i].first, replacements[i].second, newParas[i]);
+    // Running out of data is an error too once there is no more: the
+    // document ends before its last element does. What was written so far
+    // can't be taken back, so the merge fails rather than keeping the original.
+    if (xml.hasError()) {
+        if (xmlError)
+            *xmlError = xml.errorString();
+        return false;
+    }
+    if (r != ARCHIVE_EOF)
+        return false;
+
+    if (paraId < translatedParas.size()) {
+        qWarning() << "DOCX merge:" << translatedParas.size() - paraId << "translated paragraphs left unused";
     }
 
-    return result;
+    return true;
 }
 
 bool DocumentMerger::rebuildDocxWithTranslation(const QString &originalPath,
-                                                 const QString &translatedText,
+                                                 const QVector<QString> &translatedParas,
                                                  const QString &outputPath) {
     // Strategy: Copy the DOCX and replace text content in word/document.xml
     // while preserving ALL formatting, styles, tables, images, etc.
@@ -160,40 +310,39 @@ bool DocumentMerger::rebuildDocxWithTranslation(const QString &originalPath,
         return false;
     }
 
-    while (archive_read_next_header(reader, &entry) == ARCHIVE_OK) {
+    QString failure;
+    QString xmlError;
+    int r;
+    while ((r = archive_read_next_header(reader, &entry)) == ARCHIVE_OK) {
         QString entryName = QString::fromUtf8(archive_entry_pathname(entry));
 
         if (entryName == "word/document.xml") {
-            // Read the original document.xml
-            size_t size = archive_entry_size(entry);
-            QByteArray originalContent;
-            originalContent.resize(size);
-            archive_read_data(reader, originalContent.data(), size);
-
             // Replace text in XML while preserving structure
-            QString originalXml = QString::fromUtf8(originalContent);
-            QString modifiedXml = replaceTextInWordXml(originalXml, translatedText);
-
-            QByteArray newContent = modifiedXml.toUtf8();
-
-            // Write modified entry
-            archive_entry_set_size(entry, newContent.size());
-            archive_write_header(writer, entry);
-            archive_write_data(writer, newContent.constData(), newContent.size());
+            if (!replaceTextInWordXml(reader, writer, entry, translatedParas, &xmlError)) {
+                failure = entryName;
+                break;
+            }
         } else {
             // Copy other entries unchanged (styles, images, etc.)
-            size_t size = archive_entry_size(entry);
-            archive_write_header(writer, entry);
-
-            if (size > 0) {
-                QByteArray buffer;
-                buffer.resize(size);
-                archive_read_data(reader, buffer.data(), size);
-                archive_write_data(writer, buffer.constData(), size);
+            if (!translateLocally::copyEntry(reader, writer, entry)) {
+                failure = entryName;
+                break;
             }
         }
     }
 
+    if (failure.isEmpty() && r != ARCHIVE_EOF)
+        failure = originalPath;
+
+    if (!failure.isEmpty()) {
+        QString message = xmlError.isEmpty() ? translateLocally::archiveError(reader, writer) : xmlError;
+        archive_read_free(reader);
+        archive_write_free(writer);
+        QFile::remove(outputPath);
+        emit error(tr("Could not rebuild DOCX (%1): %2").arg(failure, message));
+        return false;
+    }
+
     archive_read_free(reader);
     archive_write_close(writer);
     archive_write_free(writer);
@@ -207,98 +356,52 @@ bool DocumentMerger::mergeToEpub(const QString &originalEpubPath,
                                   const QList<DocumentSplitter::Segment> &translatedSegments,
                                   const QString &title,
                                   const QString &outputPath) {
-    Q_UNUSED(title);
+    Q_UNUSED(originalSegments);
 
-    // Build a map from identifier to translated text and original XHTML
-    QMap<QString, QString> chapterTranslations;
-    QMap<QString, QString> chapterOriginalXhtml;
-    for (int i = 0; i < translatedSegments.size() && i < originalSegments.size(); i++) {
-        chapterTranslations[originalSegments[i].identifier] = translatedSegments[i].text;
-        chapterOriginalXhtml[originalSegments[i].identifier] = originalSegments[i].originalXhtml;
-    }
+    // Segments carry the name of the entry they came from, and paragraph ids
+    // are block numbers within that entry.
+    QMap<QString, QList<DocumentSplitter::Segment>> chapterSegments;
+    for (const auto &seg : translatedSegments)
+        chapterSegments[seg.entry].append(seg);
+
+    QMap<QString, QVector<QString>> chapterTranslations;
+    for (auto it = chapterSegments.cbegin(); it != chapterSegments.cend(); ++it)
+        chapterTranslations.insert(it.key(), translationsById(it.value()));
 
-    return rebuildEpubWithTranslation(originalEpubPath, chapterTranslations, chapterOriginalXhtml, title, outputPath);
+    return rebuildEpubWithTranslation(originalEpubPath, chapterTranslations, title, outputPath);
 }
 
-QString DocumentMerger::replaceTextInXhtml(const QString &originalXhtml, const QString &translatedText) {
+QByteArray DocumentMerger::replaceTextInXhtml(const QByteArray &originalXhtml, const QVector<QString> &translatedBlocks) {
     // PARAGRAPH-BY-PARAGRAPH APPROACH for EPUB: Similar to DOCX
-    // Preserve paragraph structure, replace text content while keeping HTML tags
-
-    if (translatedText.trimmed().isEmpty()) {
+    // The content of each block DocumentSplitter extracted is replaced by its
+    // translated inner HTML, so inline markup kept by the translation service
+    // survives. Everything between blocks is copied as-is, in a single pass.
+    if (translatedBlocks.isEmpty()) {
         return originalXhtml;
     }
 
-    // Split translated text by newlines (DocumentSplitter concatenates with \n)
-    QStringList translatedParas = translatedText.split('\n', Qt::SkipEmptyParts);
-    int transIndex = 0;
-
-    QString result = originalXhtml;
-
-    // Find all <p>, <h1>, <h2>, <h3>, <h4>, <h5>, <h6> elements
-    // Pattern matches: <tag ...> content </tag>
-    QRegularExpression paraPattern("<(p|h[1-6])(\\s[^>]*)?>.*?</\\1>",
-                                    QRegularExpression::DotMatchesEverythingOption);
-    QRegularExpressionMatchIterator paraIt = paraPattern.globalMatch(originalXhtml);
-
-    QVector<QPair<int, int>> replacements;
-    QStringList newParas;
+    QString xhtml = QString::fromUtf8(originalXhtml);
+    QString result;
+    result.reserve(xhtml.size() + xhtml.size() / 4);
 
-    while (paraIt.hasNext() && transIndex < translatedParas.size()) {
-        QRegularExpressionMatch paraMatch = paraIt.next();
-        QString originalPara = paraMatch.captured(0);
-        QString tagName = paraMatch.captured(1); // p, h1, h2, etc.
-        QString tagAttrs = paraMatch.captured(2); // attributes
+    int copied = 0;
+    const QVector<DocumentSplitter::XhtmlBlock> blocks = DocumentSplitter::findXhtmlBlocks(xhtml);
+    for (int id = 0; id < blocks.size() && id < translatedBlocks.size(); ++id) {
+        if (translatedBlocks[id].isNull())
+            continue; // Not translated, keep the original
 
-        // Extract text content from this paragraph (strip all tags)
-        QString paraText;
-        QRegularExpression tagPattern("<[^>]+>");
-        paraText = originalPara;
-        paraText.remove(tagPattern); // Remove all HTML tags
-        paraText = paraText.trimmed();
-
-        // Skip empty paragraphs
-        if (paraText.isEmpty()) {
-            continue;
-        }
-
-        // Get corresponding translated paragraph
-        QString transPara = translatedParas[transIndex++].trimmed();
-        if (transPara.isEmpty()) {
-            transPara = " "; // Keep structure, insert space
-        }
-
-        // Rebuild paragraph: For simplicity, replace ALL content between opening and closing tag
-        // This preserves the paragraph tag itself but loses inline formatting
-        // Future improvement: preserve <b>, <i>, etc. tags with more sophisticated parsing
-        QString newPara = originalPara;
-
-        // Pattern to match: <tag...>CONTENT</tag>
-        // We want to replace CONTENT with the translated text
-        QRegularExpression contentPattern(QString("(<(%1)([^>]*)>).*?(</\\2>)")
-                                          .arg(tagName),
-                                          QRegularExpression::DotMatchesEverythingOption);
-        QRegularExpressionMatch contentMatch = contentPattern.match(originalPara);
-
-        if (contentMatch.hasMatch()) {
-            // Build: <opening tag>translated text</closing tag>
-            newPara = contentMatch.captured(1) + transPara + contentMatch.captured(4);
-        }
-
-        replacements.append(qMakePair(paraMatch.capturedStart(), paraMatch.capturedLength()));
-        newParas.append(newPara);
+        result.append(xhtml.constData() + copied, blocks[id].begin - copied);
+        QString translated = translatedBlocks[id].trimmed();
+        result += translated.isEmpty() ? QString(" ") : toXhtmlFragment(translated); // Keep structure
+        copied = blocks[id].end;
     }
+    result.append(xhtml.constData() + copied, xhtml.size() - copied);
 
-    // Replace paragraphs in reverse order to maintain positions
-    for (int i = replacements.size() - 1; i >= 0; i--) {
-        result.replace(replacements[i].first, replacements[i].second, newParas[i]);
-    }
-
-    return result;
+    return result.toUtf8();
 }
 
 bool DocumentMerger::rebuildEpubWithTranslation(const QString &originalPath,
-                                                 const QMap<QString, QString> &chapterTranslations,
-                                                 const QMap<QString, QString> &chapterOriginalXhtml,
+                                                 const QMap<QString, QVector<QString>> &chapterTranslations,
                                                  const QString &title,
                                                  const QString &outputPath) {
     Q_UNUSED(title);
@@ -325,71 +428,92 @@ bool DocumentMerger::rebuildEpubWithTranslation(const QString &originalPath,
     int processed = 0;
     int total = chapterTranslations.size();
 
-    while (archive_read_next_header(reader, &entry) == ARCHIVE_OK) {
+    // Chapters are rewritten on the thread pool. Entries are still written in
+    // the order they are read: a chapter is only written once all chapters
+    // before it are, and any other entry waits until all pending chapters are
+    // written. Bounded so only a few chapters are in memory at once.
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const size_t maxPending = 2 * std::max(1, pool->maxThreadCount());
+    std::deque<std::pair<struct archive_entry *, std::future<QByteArray>>> pending;
+
+    QString failure;
+
+    auto writePending = [&]() {
+        struct archive_entry *chapterEntry = pending.front().first;
+        QByteArray newContent = pending.front().second.get();
+        pending.pop_front();
+
+        bool written = translateLocally::writeEntry(writer, chapterEntry, newContent);
+        if (!written)
+            failure = QString::fromUtf8(archive_entry_pathname(chapterEntry));
+        archive_entry_free(chapterEntry);
+
+        processed++;
+        emit progress(processed, total);
+        return written;
+    };
+
+    auto writeAllPending = [&]() {
+        while (!pending.empty()) {
+            if (!writePending())
+                return false;
+        }
+        return true;
+    };
+
+    int r;
+    while ((r = archive_read_next_header(reader, &entry)) == ARCHIVE_OK) {
         QString entryName = QString::fromUtf8(archive_entry_pathname(entry));
 
-        if (chapterTranslations.contains(entryName) ||
-            chapterTranslations.contains(entryName + "_part0")) {
-            // This is a chapter that was translated
-            size_t size = archive_entry_size(entry);
+        if (chapterTranslations.contains(entryName)) {
+            // This is a chapter that was translated. Its original XHTML is
+            // read back from the archive here rather than kept around since
+            // splitting.
             QByteArray originalContent;
-            originalContent.resize(size);
-            archive_read_data(reader, originalContent.data(), size);
-
-            // Get the translated text for this chapter
-            QString translated;
-            QString originalXhtml;
-            if (chapterTranslations.contains(entryName)) {
-                translated = chapterTranslations[entryName];
-                originalXhtml = chapterOriginalXhtml.value(entryName);
-            } else {
-                // Collect all parts
-                for (int i = 0; ; i++) {
-                    QString partKey = QString("%1_part%2").arg(entryName).arg(i);
-                    if (chapterTranslations.contains(partKey)) {
-                        translated += chapterTranslations[partKey] + " ";
-                        if (i == 0) {
-                            originalXhtml = chapterOriginalXhtml.value(partKey);
-                        }
-                    } else {
-                        break;
-                    }
-                }
+            if (!translateLocally::readEntryData(reader, originalContent)) {
+                failure = entryName;
+                break;
             }
 
-            // Preserve original XHTML structure, replacing only text nodes
-            QString newXhtml;
-            if (!originalXhtml.isEmpty()) {
-                newXhtml = replaceTextInXhtml(originalXhtml, translated);
-            } else {
-                // Fallback if no original XHTML stored (shouldn't happen with new code)
-                newXhtml = QString(R"(<?xml version="1.0" encoding="UTF-8"?>
-<!DOCTYPE html>
-<html xmlns="http://www.w3.org/1999/xhtml">
-<body><p>%1</p></body></html>)").arg(translated.toHtmlEscaped());
-            }
-
-            QByteArray newContent = newXhtml.toUtf8();
-            archive_entry_set_size(entry, newContent.size());
-            archive_write_header(writer, entry);
-            archive_write_data(writer, newContent.constData(), newContent.size());
+            if (pending.size() >= maxPending && !writePending())
+                break;
 
-            processed++;
-            emit progress(processed, total);
+            // Preserve original XHTML structure, replacing only text nodes
+            QVector<QString> translated = chapterTranslations[entryName];
+            pending.emplace_back(archive_entry_clone(entry), translateLocally::runOnPool(pool, [originalContent, translated]() {
+                return replaceTextInXhtml(originalContent, translated);
+            }));
         } else {
+            if (!writeAllPending())
+                break;
+
             // Copy unchanged
-            size_t size = archive_entry_size(entry);
-            archive_write_header(writer, entry);
-
-            if (size > 0) {
-                QByteArray buffer;
-                buffer.resize(size);
-                archive_read_data(reader, buffer.data(), size);
-                archive_write_data(writer, buffer.constData(), size);
+            if (!translateLocally::copyEntry(reader, writer, entry)) {
+                failure = entryName;
+                break;
             }
         }
     }
 
+    if (failure.isEmpty() && r != ARCHIVE_EOF)
+        failure = originalPath;
+    if (failure.isEmpty())
+        writeAllPending();
+
+    if (!failure.isEmpty()) {
+        // Chapters still being rewritten finish on the pool and are dropped
+        for (auto &chapter : pending)
+            archive_entry_free(chapter.first);
+        pending.clear();
+
+        QString message = translateLocally::archiveError(reader, writer);
+        archive_read_free(reader);
+        archive_write_free(writer);
+        QFile::remove(outputPath);
+        emit error(tr("Could not rebuild EPUB (%1): %2").arg(failure, message));
+        return false;
+    }
+
     archive_read_free(reader);
     archive_write_close(writer);
     archive_write_free(writer);
@@ -397,3 +521,360 @@ bool DocumentMerger::rebuildEpubWithTranslation(const QString &originalPath,
     emit mergeComplete(outputPath);
     return true;
 }
+
+bool DocumentMerger::mergeWithFormat(const QString &originalPath,
+                                     const QList<DocumentSplitter::Segment> &translatedSegments,
+                                     const QString &outputPath) {
+    const DocumentFormat *format = DocumentFormat::forPath(originalPath);
+    if (!format) {
+        emit error(tr("Unsupported file format: %1").arg(QFileInfo(originalPath).suffix()));
+        return false;
+    }
+
+    QString errorMessage;
+    if (!format->rewrite(originalPath, translationsById(translatedSegments), outputPath, &errorMessage)) {
+        emit error(tr("Could not write %1 (%2): %3").arg(format->name(), outputPath, errorMessage));
+        return false;
+    }
+
+    emit mergeComplete(outputPath);
+    return true;
+}
+
+bool DocumentMerger::openStream(const QString &originalPath, const QString &outputPath) {
+    stream_.reset(new Stream);
+    stream_->epub = QFileInfo(originalPath).suffix().toLower() == "epub";
+    stream_->outputPath = outputPath;
+
+#ifdef HAVE_POPPLER
+    // A PDF keeps its layout, unless plain text (.txt) is asked for
+    if (QFileInfo(originalPath).suffix().toLower() == "pdf" && !outputPath.endsWith(".txt", Qt::CaseInsensitive))
+        return openPdfStream(originalPath);
+#endif
+
+    if (!stream_->epub) {
+        stream_->file.setFileName(outputPath);
+        if (!stream_->file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            emit error(tr("Could not open file for writing: %1").arg(outputPath));
+            stream_.reset();
+            return false;
+        }
+        return true;
+    }
+
+    stream_->reader = archive_read_new();
+    stream_->writer = archive_write_new();
+    archive_read_support_format_all(stream_->reader);
+    archive_read_support_filter_all(stream_->reader);
+    archive_write_set_format_zip(stream_->writer);
+
+    if (archive_read_open_filename(stream_->reader, originalPath.toUtf8().constData(), 10240) != ARCHIVE_OK) {
+        emit error(tr("Could not open original EPUB: %1").arg(originalPath));
+        stream_.reset();
+        return false;
+    }
+
+    if (archive_write_open_filename(stream_->writer, outputPath.toUtf8().constData()) != ARCHIVE_OK) {
+        emit error(tr("Could not create output EPUB: %1").arg(outputPath));
+        stream_.reset();
+        return false;
+    }
+    return true;
+}
+
+bool DocumentMerger::writeSegment(const DocumentSplitter::Segment &segment) {
+    if (!stream_)
+        return false;
+
+#ifdef HAVE_POPPLER
+    if (stream_->pdf) {
+        for (const auto &para : segment.paragraphs)
+            stream_->blocks.insert(para.id, para.text.isNull() ? QString("") : para.text);
+        return writePdfPages(false);
+    }
+#endif
+
+    if (!stream_->epub) {
+        QByteArray text = segment.text().toUtf8();
+        if (!stream_->first)
+            text.prepend('\n');
+        stream_->first = false;
+        if (stream_->file.write(text) != text.size()) {
+            emit error(tr("Could not write %1: %2").arg(stream_->outputPath, stream_->file.errorString()));
+            abortStream();
+            return false;
+        }
+        return true;
+    }
+
+    // A segment of the next chapter: the previous one is complete
+    if (segment.entry != stream_->chapter) {
+        if (!writeStreamChapter())
+            return false;
+        stream_->chapter = segment.entry;
+        stream_->translations.clear();
+    }
+
+    for (const auto &para : segment.paragraphs) {
+        if (para.id >= stream_->translations.size())
+            stream_->translations.resize(para.id + 1);
+        stream_->translations[para.id] = para.text.isNull() ? QString("") : para.text;
+    }
+    return true;
+}
+
+bool DocumentMerger::writeStreamChapter() {
+    Stream &stream = *stream_;
+    if (stream.chapter.isEmpty())
+        return true;
+
+    // Everything before the chapter is copied as it is
+    QString failure;
+    struct archive_entry *entry;
+    int r;
+    while ((r = archive_read_next_header(stream.reader, &entry)) == ARCHIVE_OK) {
+        QString entryName = QString::fromUtf8(archive_entry_pathname(entry));
+        if (entryName != stream.chapter) {
+            if (!translateLocally::copyEntry(stream.reader, stream.writer, entry)) {
+                failure = entryName;
+                break;
+            }
+            continue;
+        }
+
+        QByteArray originalContent;
+        if (!translateLocally::readEntryData(stream.reader, originalContent) ||
+            !translateLocally::writeEntry(stream.writer, entry, replaceTextInXhtml(originalContent, stream.translations)))
+            failure = entryName;
+        break;
+    }
+
+    if (failure.isEmpty() && r != ARCHIVE_OK)
+        failure = stream.chapter;
+
+    if (!failure.isEmpty()) {
+        emit error(tr("Could not rebuild EPUB (%1): %2").arg(failure, translateLocally::archiveError(stream.reader, stream.writer)));
+        abortStream();
+        return false;
+    }
+    return true;
+}
+
+bool DocumentMerger::closeStream() {
+    if (!stream_)
+        return false;
+
+#ifdef HAVE_POPPLER
+    if (stream_->pdf) {
+        // Blocks without a translation keep their text
+        if (!writePdfPages(true))
+            return false;
+        if (!stream_->blocks.isEmpty())
+            qWarning() << "PDF merge:" << stream_->blocks.size() << "translated blocks left unused";
+
+        if (stream_->pdfWriter) {
+            if (stream_->painter->isActive())
+                stream_->painter->end();
+        } else if (stream_->file.write("</body>\n</html>\n") < 0 || !stream_->file.flush()) {
+            emit error(tr("Could not write %1: %2").arg(stream_->outputPath, stream_->file.errorString()));
+            abortStream();
+            return false;
+        }
+    }
+#endif
+
+    if (!stream_->epub) {
+        stream_->file.close();
+    } else {
+        if (!writeStreamChapter())
+            return false;
+
+        // The rest of the archive
+        struct archive_entry *entry;
+        int r;
+        while ((r = archive_read_next_header(stream_->reader, &entry)) == ARCHIVE_OK) {
+            if (!translateLocally::copyEntry(stream_->reader, stream_->writer, entry))
+                break;
+        }
+        if (r != ARCHIVE_EOF || archive_write_close(stream_->writer) != ARCHIVE_OK) {
+            emit error(tr("Could not rebuild EPUB (%1): %2").arg(stream_->outputPath, translateLocally::archiveError(stream_->reader, stream_->writer)));
+            abortStream();
+            return false;
+        }
+    }
+
+    QString outputPath = stream_->outputPath;
+    stream_.reset();
+    emit mergeComplete(outputPath);
+    return true;
+}
+
+void DocumentMerger::abortStream() {
+    if (!stream_)
+        return;
+    QString outputPath = stream_->outputPath;
+    stream_.reset();
+    QFile::remove(outputPath);
+}
+
+#ifdef HAVE_POPPLER
+bool DocumentMerger::canWritePdf() {
+    return qobject_cast<QGuiApplication *>(QCoreApplication::instance()) != nullptr;
+}
+
+bool DocumentMerger::mergeToPdf(const QString &originalPdfPath,
+                                const QList<DocumentSplitter::Segment> &translatedSegments,
+                                const QString &outputPath) {
+    // The stream, fed all segments in order
+    if (!openStream(originalPdfPath, outputPath))
+        return false;
+
+    QList<DocumentSplitter::Segment> sorted = translatedSegments;
+    std::sort(sorted.begin(), sorted.end(), [](const DocumentSplitter::Segment &a, const DocumentSplitter::Segment &b) {
+        return a.index < b.index;
+    });
+    for (const auto &segment : sorted) {
+        if (!writeSegment(segment))
+            return false;
+    }
+    return closeStream();
+}
+
+bool DocumentMerger::openPdfStream(const QString &originalPdfPath) {
+    Stream &stream = *stream_;
+    stream.pdf = true;
+    stream.document.reset(poppler::document::load_from_file(originalPdfPath.toStdString()));
+    if (!stream.document || stream.document->is_locked()) {
+        emit error(tr("Could not open original PDF: %1").arg(originalPdfPath));
+        stream_.reset();
+        return false;
+    }
+    stream.pages = stream.document->pages();
+
+    if (stream.outputPath.endsWith(".pdf", Qt::CaseInsensitive)) {
+        if (!canWritePdf()) {
+            emit error(tr("PDF output can only be written from the graphical interface. "
+                          "Save as .html (same layout) or .txt instead: %1").arg(stream.outputPath));
+            stream_.reset();
+            return false;
+        }
+        stream.pdfWriter.reset(new QPdfWriter(stream.outputPath));
+        stream.pdfWriter->setResolution(72); // One unit is one point, as in PdfLayout
+        stream.pdfWriter->setPageMargins(QMarginsF(0, 0, 0, 0));
+        stream.painter.reset(new QPainter);
+        return true;
+    }
+
+    // Otherwise an HTML page per PDF page
+    stream.file.setFileName(stream.outputPath);
+    QByteArray head = ("<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>" +
+                       QFileInfo(originalPdfPath).completeBaseName().toHtmlEscaped() + "</title>\n"
+                       "<style>\n"
+                       ".page { position: relative; margin: 1em auto; background: white; box-shadow: 0 0 4px #888; overflow: hidden; }\n"
+                       ".page div { position: absolute; line-height: 1.15; font-family: sans-serif; }\n"
+                       "</style>\n</head>\n<body style=\"background: #eee\">\n").toUtf8();
+    if (!stream.file.open(QIODevice::WriteOnly) || stream.file.write(head) != head.size()) {
+        emit error(tr("Could not open file for writing: %1").arg(stream.outputPath));
+        stream_.reset();
+        return false;
+    }
+    return true;
+}
+
+bool DocumentMerger::writePdfPages(bool all) {
+    Stream &stream = *stream_;
+    while (stream.nextPage < stream.pages) {
+        if (!stream.layout) {
+            std::unique_ptr<poppler::page> page(stream.document->create_page(stream.nextPage));
+            if (!page) {
+                stream.nextPage++;
+                continue;
+            }
+            stream.layout.reset(new PdfLayout::Page(PdfLayout::readPage(*page)));
+        }
+
+        // Blocks are numbered over the whole document, as DocumentSplitter
+        // read them. Unless this is the end, wait for all of this page's.
+        const int count = stream.layout->blocks.size();
+        for (int id = stream.nextBlock; !all && id < stream.nextBlock + count; ++id) {
+            if (!stream.blocks.contains(id))
+                return true;
+        }
+
+        if (!writePdfPage(*stream.layout))
+            return false;
+        stream.nextBlock += count;
+        stream.nextPage++;
+        stream.layout.reset();
+        emit progress(stream.nextPage, stream.pages);
+    }
+    return true;
+}
+
+bool DocumentMerger::writePdfPage(const PdfLayout::Page &layout) {
+    Stream &stream = *stream_;
+    QPainter *painter = stream.painter.get(); // Only for a PDF
+    const bool writePdf = painter != nullptr;
+    QString html;
+
+    if (writePdf) {
+        stream.pdfWriter->setPageSize(QPageSize(layout.size, QPageSize::Point));
+        if (!painter->isActive()) {
+            if (!painter->begin(stream.pdfWriter.get())) {
+                emit error(tr("Could not create output PDF: %1").arg(stream.outputPath));
+                abortStream();
+                return false;
+            }
+        } else {
+            stream.pdfWriter->newPage();
+        }
+    } else {
+        html += QString("<div class=\"page\" style=\"width: %1pt; height: %2pt\">\n")
+                    .arg(layout.size.width()).arg(layout.size.height());
+    }
+
+    int blockId = stream.nextBlock;
+    for (const PdfLayout::Block &block : layout.blocks) {
+        // Blocks without a translation keep their text
+        auto translation = stream.blocks.find(blockId++);
+        QString text = block.text;
+        if (translation != stream.blocks.end()) {
+            text = translation.value().trimmed();
+            stream.blocks.erase(translation);
+        }
+
+        if (writePdf) {
+            // Translations are often longer: shrink the font (down to
+            // 60%) until the text fits the block.
+            QFont font = painter->font();
+            qreal size = block.fontSize;
+            const int flags = Qt::TextWordWrap | Qt::AlignLeft | Qt::AlignTop;
+            for (int step = 0; step < 8; ++step) {
+                font.setPointSizeF(size);
+                painter->setFont(font);
+                if (painter->boundingRect(block.rect, flags, text).height() <= block.rect.height() * 1.05)
+                    break;
+                size *= 0.94;
+            }
+            painter->drawText(block.rect, flags, text);
+        } else {
+            html += QString("<div style=\"left: %1pt; top: %2pt; width: %3pt; font-size: %4pt\">")
+                        .arg(block.rect.left()).arg(block.rect.top())
+                        .arg(block.rect.width()).arg(block.fontSize);
+            html += text.toHtmlEscaped();
+            html += "</div>\n";
+        }
+    }
+
+    if (!writePdf) {
+        html += "</div>\n";
+        QByteArray bytes = html.toUtf8();
+        if (stream.file.write(bytes) != bytes.size()) {
+            emit error(tr("Could not write %1: %2").arg(stream.outputPath, stream.file.errorString()));
+            abortStream();
+            return false;
+        }
+    }
+    return true;
+}
+#endif
@@ -4,12 +4,21 @@
 #include <QString>
 #include <QObject>
 #include <QList>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
+#include <memory>
 #include "DocumentSplitter.h"
+#include "PdfLayout.h"
+
+struct archive;
+struct archive_entry;
 
 class DocumentMerger : public QObject {
     Q_OBJECT
 public:
     explicit DocumentMerger(QObject *parent = nullptr);
+    ~DocumentMerger();
 
     // Merge translated segments back into documents
     bool mergeToTxt(const QList<DocumentSplitter::Segment> &translatedSegments,
@@ -26,29 +35,81 @@ public:
                      const QString &title,
                      const QString &outputPath);
 
+    // Documents read by a DocumentFormat handler (ODT, PPTX, HTML...)
+    bool mergeWithFormat(const QString &originalPath,
+                         const QList<DocumentSplitter::Segment> &translatedSegments,
+                         const QString &outputPath);
+
+    /**
+     * Streaming merge for TXT, EPUB and PDF, the counterpart of
+     * DocumentSplitter::openStream(): writeSegment() takes the translated
+     * segments in the order the splitter read them, and the output is written
+     * as soon as possible. For EPUB, a chapter is written once a segment of
+     * the next one (or closeStream()) comes. A PDF page is written once all
+     * of its blocks are translated, as mergeToPdf() would. After an error the
+     * output is removed and the stream closed.
+     */
+    bool openStream(const QString &originalPath, const QString &outputPath);
+    bool writeSegment(const DocumentSplitter::Segment &segment);
+    bool closeStream();
+    void abortStream();
+
+#ifdef HAVE_POPPLER
+    // Whether mergeToPdf() can write a PDF: painting text needs the fonts of
+    // a GUI application.
+    static bool canWritePdf();
+
+    // Puts the translation of each text block of `originalPdfPath` where the
+    // block was (see PdfLayout). Writes a PDF if outputPath ends in .pdf,
+    // otherwise an HTML page per PDF page. A PDF needs fonts, so it can only
+    // be written from the GUI (see canWritePdf()); without it, a .pdf
+    // outputPath is an error. Same as the stream, given all segments.
+    bool mergeToPdf(const QString &originalPdfPath,
+                    const QList<DocumentSplitter::Segment> &translatedSegments,
+                    const QString &outputPath);
+#endif
+
 signals:
     void progress(int current, int total);
     void mergeComplete(QString path);
     void error(QString message);
 
 private:
+    struct Stream;
+    bool writeStreamChapter();
+
+#ifdef HAVE_POPPLER
+    // PDF part of openStream(), on the Stream it has made
+    bool openPdfStream(const QString &originalPdfPath);
+    // Writes the pages whose blocks all have a translation, in order; all
+    // pages that are left if `all`.
+    bool writePdfPages(bool all);
+    bool writePdfPage(const PdfLayout::Page &layout);
+#endif
+
     // Helper to rebuild DOCX with translated content
     bool rebuildDocxWithTranslation(const QString &originalPath,
-                                    const QString &translatedText,
+                                    const QVector<QString> &translatedParas,
                                     const QString &outputPath);
 
     // Helper to rebuild EPUB with translated chapters
     bool rebuildEpubWithTranslation(const QString &originalPath,
-                                    const QMap<QString, QString> &chapterTranslations,
-                                    const QMap<QString, QString> &chapterOriginalXhtml,
+                                    const QMap<QString, QVector<QString>> &chapterTranslations,
                                     const QString &title,
                                     const QString &outputPath);
 
-    // Helper to replace text nodes in Word XML while preserving structure
-    QString replaceTextInWordXml(const QString &originalXml, const QString &translatedText);
+    // Helper to replace text nodes in Word XML while preserving structure:
+    // copies the current entry of `reader` (word/document.xml) to `writer` a
+    // block at a time. translatedParas is indexed by paragraph id; null: keep
+    // the original. An XML error goes to `xmlError`.
+    bool replaceTextInWordXml(struct archive *reader, struct archive *writer, struct archive_entry *entry,
+                              const QVector<QString> &translatedParas, QString *xmlError);
+
+    // Helper to replace text nodes in XHTML while preserving structure.
+    // Static: runs on the thread pool.
+    static QByteArray replaceTextInXhtml(const QByteArray &originalXhtml, const QVector<QString> &translatedBlocks);
 
-    // Helper to replace text nodes in XHTML while preserving structure
-    QString replaceTextInXhtml(const QString &originalXhtml, const QString &translatedText);
+    std::unique_ptr<Stream> stream_;
 };
 
 #endif // DOCUMENTMERGER_H
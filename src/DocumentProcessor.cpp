@@ -1,17 +1,41 @@
 #include "DocumentProcessor.h"
+#include "DocumentFormat.h"
+#include "formats/SubtitleFormat.h"
 #include <QFileInfo>
+#include <QHash>
 #include <QDebug>
 
 DocumentProcessor::DocumentProcessor(const QString &inputPath, const QString &outputPath, QObject *parent)
-    : QObject(parent), m_inputPath(inputPath), m_outputPath(outputPath), m_splitter(this), m_merger(this)
+    : QObject(parent), m_inputPath(inputPath), m_outputPath(outputPath), m_splitter(this), m_merger(this),
+      m_useManifest(false), m_manifestRefined(false), m_useMemory(false),
+      m_fuzzyThreshold(TranslationMemory::DEFAULT_FUZZY_THRESHOLD), m_reusedCount(0)
 {
 }
 
 DocumentProcessor::DocumentProcessor(QObject *parent)
-    : QObject(parent), m_splitter(this), m_merger(this)
+    : QObject(parent), m_splitter(this), m_merger(this), m_useManifest(false), m_manifestRefined(false),
+      m_useMemory(false), m_fuzzyThreshold(TranslationMemory::DEFAULT_FUZZY_THRESHOLD), m_reusedCount(0)
 {
 }
 
+void DocumentProcessor::setWordBudget(int words) {
+    m_splitter.setWordBudget(words);
+}
+
+void DocumentProcessor::enableManifest(const QString &model, const QString &refiner) {
+    m_useManifest = true;
+    m_manifestRefined = !refiner.isEmpty();
+    m_manifestId = refiner.isEmpty() ? model : model + "|" + refiner;
+}
+
+void DocumentProcessor::enableTranslationMemory(const QString &sourceLanguage, const QString &targetLanguage,
+                                                double fuzzyThreshold) {
+    m_useMemory = true;
+    m_memorySource = sourceLanguage;
+    m_memoryTarget = targetLanguage;
+    m_fuzzyThreshold = fuzzyThreshold;
+}
+
 bool DocumentProcessor::open() {
     QFileInfo info(m_inputPath);
     if (!info.exists()) {
@@ -19,24 +43,241 @@ bool DocumentProcessor::open() {
         return false;
     }
 
-    if (DocumentSplitter::needsSplitting(m_inputPath)) {
-        m_segments = m_splitter.splitDocument(m_inputPath);
-        return !m_segments.isEmpty();
-    } else {
-        m_segments = m_splitter.splitDocument(m_inputPath);
-        return !m_segments.isEmpty();
-    }
+    // Every document is split: by size (MAX_SEGMENT_SIZE) and by the word
+    // budget, so even small files are translated in several requests.
+    m_segments = m_splitter.splitDocument(m_inputPath);
+
+    openReuse();
+    return !m_segments.isEmpty();
 }
 
 QList<DocumentSplitter::Segment> DocumentProcessor::getSegments() {
     return m_segments;
 }
 
+QList<DocumentSplitter::Segment> DocumentProcessor::getPendingSegments() {
+    m_reused.clear();
+    m_reusedCount = 0;
+    m_fuzzyMatches.clear();
+    if (!m_useManifest && !m_useMemory)
+        return m_segments;
+
+    QList<DocumentSplitter::Segment> pending;
+    for (const auto &seg : m_segments) {
+        DocumentSplitter::Segment part = pendingPart(seg, m_reused[seg.index]);
+        if (!part.paragraphs.isEmpty())
+            pending.append(part);
+    }
+
+    qDebug() << "Reusing" << m_reusedCount << "translated paragraphs," << m_fuzzyMatches.size() << "fuzzy matches";
+    return pending;
+}
+
+int DocumentProcessor::reusedParagraphs() const {
+    return m_reusedCount;
+}
+
+QList<DocumentProcessor::FuzzyMatch> DocumentProcessor::fuzzyMatches() const {
+    return m_fuzzyMatches;
+}
+
 void DocumentProcessor::setTranslatedSegments(const QList<DocumentSplitter::Segment> &segments) {
-    m_translatedSegments = segments;
+    if (!m_useManifest && !m_useMemory) {
+        m_translatedSegments = segments;
+        return;
+    }
+
+    QHash<int, DocumentSplitter::Segment> translatedByIndex;
+    for (const auto &seg : segments)
+        translatedByIndex.insert(seg.index, seg);
+
+    m_translatedSegments.clear();
+    for (const auto &seg : m_segments)
+        m_translatedSegments.append(completeSegment(seg, m_reused.value(seg.index), translatedByIndex.value(seg.index)));
 }
 
 bool DocumentProcessor::save() {
+    if (!merge())
+        return false;
+
+    saveReuse();
+    return true;
+}
+
+bool DocumentProcessor::shouldStream(const QString &inputPath) {
+    // A streamed document has no word count up front, so no time left is
+    // shown: only worth it when the document would not fit in memory
+    if (!DocumentSplitter::canStream(inputPath))
+        return false;
+    return QFileInfo(inputPath).size() >= STREAMING_THRESHOLD;
+}
+
+bool DocumentProcessor::translateStreaming(DocumentTranslationEngine &engine) {
+    m_reusedCount = 0;
+    m_fuzzyMatches.clear();
+
+    if (!m_splitter.openStream(m_inputPath))
+        return false;
+    openReuse();
+    if (!m_merger.openStream(m_inputPath, m_outputPath)) {
+        m_splitter.closeStream();
+        return false;
+    }
+
+    // Segments being translated, with the translations reused for them. The
+    // engine hands them back in the order they were read.
+    QHash<int, QPair<DocumentSplitter::Segment, QHash<int, QString>>> inFlight;
+
+    bool translated = engine.translate([&](DocumentSplitter::Segment &pending) {
+        DocumentSplitter::Segment seg;
+        if (!m_splitter.readSegment(seg))
+            return false;
+        QHash<int, QString> reused;
+        pending = pendingPart(seg, reused);
+        inFlight.insert(seg.index, {seg, reused});
+        return true;
+    }, [&](const DocumentSplitter::Segment &translation) {
+        auto original = inFlight.take(translation.index);
+        return m_merger.writeSegment(completeSegment(original.first, original.second, translation));
+    });
+
+    bool splitFailed = m_splitter.streamFailed();
+    m_splitter.closeStream();
+    if (!translated || splitFailed) {
+        m_merger.abortStream();
+        return false;
+    }
+
+    if (!m_merger.closeStream())
+        return false;
+
+    saveReuse();
+    return true;
+}
+
+bool DocumentProcessor::isSubtitles(const QString &inputPath) {
+    return SubtitleFormat().suffixes().contains(QFileInfo(inputPath).suffix().toLower());
+}
+
+bool DocumentProcessor::translateSubtitles(SubtitleTranslator &translator) {
+    SubtitleFormat format;
+    QStringList cues;
+    QString errorMessage;
+    if (!format.extract(m_inputPath, [&](QStringView text) { cues.append(text.toString()); }, &errorMessage)) {
+        qCritical() << "Could not read subtitles:" << m_inputPath << errorMessage;
+        return false;
+    }
+    if (cues.isEmpty()) {
+        qCritical() << "No subtitles found in" << m_inputPath;
+        return false;
+    }
+
+    QStringList translated = translator.translate(cues);
+    if (translated.isEmpty())
+        return false;
+
+    if (!format.rewrite(m_inputPath, QVector<QString>(translated.begin(), translated.end()), m_outputPath, &errorMessage)) {
+        qCritical() << "Could not write subtitles:" << m_outputPath << errorMessage;
+        return false;
+    }
+    return true;
+}
+
+void DocumentProcessor::openReuse() {
+    if (m_useManifest)
+        m_manifest.load(TranslationManifest::pathFor(m_outputPath), m_manifestId);
+
+    // Translating without the memory is better than not translating
+    QString memoryError;
+    if (m_useMemory && !m_memory.isOpen() && !m_memory.open(m_memorySource, m_memoryTarget, &memoryError)) {
+        qWarning() << "Not using the translation memory:" << memoryError;
+        m_useMemory = false;
+    }
+}
+
+void DocumentProcessor::saveReuse() {
+    if (m_useManifest)
+        m_manifest.save();
+
+    QString memoryError;
+    if (m_useMemory && !m_memory.save(&memoryError))
+        qWarning() << memoryError;
+}
+
+DocumentSplitter::Segment DocumentProcessor::pendingPart(const DocumentSplitter::Segment &seg, QHash<int, QString> &reused) {
+    // The segment keeps its index, entry etc. but only carries the paragraphs
+    // that have no translation yet, with their ids. The manifest goes first:
+    // it has this document's translations. Both are looked up by the text of
+    // the paragraph, not by where it is, so an edited paragraph is translated
+    // again and an unchanged one is reused wherever it is now.
+    DocumentSplitter::Segment part = seg;
+    if (!m_useManifest && !m_useMemory)
+        return part;
+
+    part.paragraphs.clear();
+    part.words = 0;
+    for (const auto &para : seg.paragraphs) {
+        if (para.text.trimmed().isEmpty())
+            continue;
+        if (m_useManifest && m_manifest.contains(para.text)) {
+            reused.insert(para.id, m_manifest.translation(para.text));
+            m_reusedCount++;
+            continue;
+        }
+        if (m_useMemory) {
+            TranslationMemory::Match match = m_memory.lookup(para.text, m_fuzzyThreshold);
+            if (match.score >= 1) {
+                reused.insert(para.id, match.target);
+                m_reusedCount++;
+                continue;
+            }
+            if (match.score > 0)
+                m_fuzzyMatches.append({seg.index, para.id, match});
+        }
+        part.paragraphs.append(para);
+        part.words += DocumentSplitter::countWords(para.text);
+    }
+    return part;
+}
+
+DocumentSplitter::Segment DocumentProcessor::completeSegment(const DocumentSplitter::Segment &seg,
+                                                             const QHash<int, QString> &reused,
+                                                             const DocumentSplitter::Segment &translated) {
+    if (!m_useManifest && !m_useMemory)
+        return translated;
+
+    // Put the translated paragraphs back among the reused ones. Ids only
+    // match paragraphs within this segment; the manifest records each by its
+    // source text.
+    QHash<int, QString> translatedById;
+    for (const auto &para : translated.paragraphs)
+        translatedById.insert(para.id, para.text);
+
+    // A segment the LLM could not refine holds machine translations, which
+    // must not be reused as refined ones: they are translated again next time.
+    bool recordTranslated = m_useManifest && (!m_manifestRefined || translated.refined);
+
+    DocumentSplitter::Segment merged = seg;
+    for (auto &para : merged.paragraphs) {
+        if (para.text.trimmed().isEmpty())
+            continue;
+
+        if (reused.contains(para.id)) {
+            if (m_useManifest)
+                m_manifest.record(para.text, reused.value(para.id));
+            para.text = reused.value(para.id);
+        } else if (translatedById.contains(para.id)) {
+            if (recordTranslated)
+                m_manifest.record(para.text, translatedById.value(para.id));
+            if (m_useMemory)
+                m_memory.add(para.text, translatedById.value(para.id));
+            para.text = translatedById.value(para.id);
+        }
+    }
+    return merged;
+}
+
+bool DocumentProcessor::merge() {
     QFileInfo info(m_inputPath);
     QString ext = info.suffix().toLower();
 
@@ -52,7 +293,14 @@ bool DocumentProcessor::save() {
         bool isPopplerPdf = !m_segments.isEmpty() && m_segments.first().identifier.startsWith("pdf_poppler_");
 
         if (isPopplerPdf) {
-            // Poppler extracts text only - save as TXT
+#ifdef HAVE_POPPLER
+            // Poppler gives us text blocks with their position: put the
+            // translations in the same place (PDF or HTML), or save plain text
+            // if that's what was asked for.
+            if (!m_outputPath.toLower().endsWith(".txt")) {
+                return m_merger.mergeToPdf(m_inputPath, m_translatedSegments, m_outputPath);
+            }
+#endif
             qDebug() << "PDF processed with Poppler - saving translation as text file";
             return m_merger.mergeToTxt(m_translatedSegments, m_outputPath);
         } else {
@@ -62,6 +310,8 @@ bool DocumentProcessor::save() {
             }
             return m_merger.mergeToDocx(m_inputPath, m_segments, m_translatedSegments, m_outputPath);
         }
+    } else if (DocumentFormat::forPath(m_inputPath)) {
+        return m_merger.mergeWithFormat(m_inputPath, m_translatedSegments, m_outputPath);
     }
 
     return false;
@@ -71,7 +321,7 @@ QString DocumentProcessor::extractText(const QString &filePath) {
     QList<DocumentSplitter::Segment> segments = m_splitter.splitDocument(filePath);
     QString fullText;
     for (const auto &seg : segments) {
-        fullText += seg.text + "\n";
+        fullText += seg.text() + "\n";
     }
     return fullText.trimmed();
 }
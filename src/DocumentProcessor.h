@@ -4,8 +4,14 @@
 #include <QObject>
 #include <QString>
 #include <QList>
+#include <QHash>
+#include <QPair>
 #include "DocumentSplitter.h"
 #include "DocumentMerger.h"
+#include "TranslationManifest.h"
+#include "TranslationMemory.h"
+#include "DocumentTranslationEngine.h"
+#include "SubtitleTranslator.h"
 
 class DocumentProcessor : public QObject {
     Q_OBJECT
@@ -13,21 +19,114 @@ public:
     explicit DocumentProcessor(const QString &inputPath, const QString &outputPath, QObject *parent = nullptr);
     explicit DocumentProcessor(QObject *parent = nullptr);
 
+    // Word budget per segment, see DocumentSplitter::setWordBudget(). Must be
+    // set before open().
+    void setWordBudget(int words);
+
+    /**
+     * Reuse translations of unchanged paragraphs from an earlier run on this
+     * document, kept in a manifest next to the output file. Only translations
+     * made with `model` (and with the same `refiner`, if the translation is
+     * improved by an LLM) are reused. Must be called before open().
+     */
+    void enableManifest(const QString &model, const QString &refiner = QString());
+
+    /**
+     * Reuse translations from the translation memory of this language pair,
+     * and add the new ones to it. Paragraphs with only a fuzzy match are still
+     * translated; see fuzzyMatches(). Must be called before open().
+     */
+    void enableTranslationMemory(const QString &sourceLanguage, const QString &targetLanguage,
+                                 double fuzzyThreshold = TranslationMemory::DEFAULT_FUZZY_THRESHOLD);
+
+    struct FuzzyMatch {
+        int segment;    // Segment::index
+        int paragraph;  // Paragraph::id
+        TranslationMemory::Match match;
+    };
+
     bool open();
     QList<DocumentSplitter::Segment> getSegments();
+
+    // The segments that need translating: all of them, or with a manifest,
+    // those with new or changed paragraphs, holding only those paragraphs.
+    // May be empty if nothing changed. Their translations (and nothing else)
+    // go to setTranslatedSegments().
+    QList<DocumentSplitter::Segment> getPendingSegments();
+
+    // Set by getPendingSegments(): paragraphs taken from the manifest or the
+    // translation memory, and the paragraphs to translate that resemble one
+    // in the translation memory.
+    int reusedParagraphs() const;
+    QList<FuzzyMatch> fuzzyMatches() const;
+
     void setTranslatedSegments(const QList<DocumentSplitter::Segment> &segments);
     bool save();
 
+    // TXT, EPUB and (with Poppler) PDF files of at least this size are
+    // translated with translateStreaming().
+    static constexpr qint64 STREAMING_THRESHOLD = 64 * 1024 * 1024;
+    static bool shouldStream(const QString &inputPath);
+
+    /**
+     * Instead of open(), getPendingSegments(), setTranslatedSegments() and
+     * save(): splits, translates with `engine` and writes the output while
+     * reading the input, through the engine's window. Memory use does not
+     * depend on the size of the document (except for what the manifest and
+     * translation memory keep). TXT, EPUB and (with Poppler) PDF only.
+     */
+    bool translateStreaming(DocumentTranslationEngine &engine);
+
+    // SRT and VTT files are translated in subtitle mode, with
+    // translateSubtitles() instead of the engine.
+    static bool isSubtitles(const QString &inputPath);
+
+    /**
+     * Instead of open() etc. for subtitles: cues are joined into sentences,
+     * translated, split over the cues again and written with their timings.
+     * The manifest and translation memory are not used.
+     */
+    bool translateSubtitles(SubtitleTranslator &translator);
+
     // Legacy support for MainWindow
     QString extractText(const QString &filePath);
 
 private:
+    bool merge();
+    void openReuse();
+    void saveReuse();
+
+    // The paragraphs of `seg` that need translating; the translations of
+    // the others, by paragraph id, go to `reused`.
+    DocumentSplitter::Segment pendingPart(const DocumentSplitter::Segment &seg, QHash<int, QString> &reused);
+    // `seg` with the translations of its paragraphs, from `reused` or `translated`.
+    DocumentSplitter::Segment completeSegment(const DocumentSplitter::Segment &seg,
+                                              const QHash<int, QString> &reused,
+                                              const DocumentSplitter::Segment &translated);
+
     QString m_inputPath;
     QString m_outputPath;
     DocumentSplitter m_splitter;
     DocumentMerger m_merger;
     QList<DocumentSplitter::Segment> m_segments;
     QList<DocumentSplitter::Segment> m_translatedSegments;
+
+    bool m_useManifest;
+    bool m_manifestRefined; // m_manifestId is for translations improved by an LLM
+    QString m_manifestId;
+    TranslationManifest m_manifest;
+
+    bool m_useMemory;
+    QString m_memorySource;
+    QString m_memoryTarget;
+    double m_fuzzyThreshold;
+    TranslationMemory m_memory;
+
+    // Translations found (by source text) for the paragraphs of this run:
+    // segment index -> paragraph id -> translation
+    QHash<int, QHash<int, QString>> m_reused;
+    int m_reusedCount;
+    QList<FuzzyMatch> m_fuzzyMatches;
 };
 
 #endif // DOCUMENTPROCESSOR_H
@@ -3,11 +3,20 @@
 #include <QFileInfo>
 #include <QDebug>
 #include <QXmlStreamReader>
-#include <QProcess>
 #include <QDir>
-#include <QTemporaryDir>
-#include <QStandardPaths>
 #include <QCoreApplication>
+#include <QStringView>
+#include <QUrl>
+#include <QHash>
+#include <QSet>
+#include <QThreadPool>
+#include <future>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include "PooledTask.h"
+#include "LibreOfficeConverter.h"
+#include "DocumentFormat.h"
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -16,9 +25,208 @@
 // Use C++ API of Poppler to avoid Qt version conflicts
 #include <poppler-document.h>
 #include <poppler-page.h>
+#include "PdfLayout.h"
 #endif
 
-DocumentSplitter::DocumentSplitter(QObject *parent) : QObject(parent) {}
+namespace {
+
+/**
+ * Number of bytes `text` takes when encoded as UTF-8, computed without
+ * actually encoding it. Unpaired surrogates count as the 3-byte replacement
+ * character, same as QString::toUtf8() produces.
+ */
+qint64 utf8Length(QStringView text) {
+    qint64 bytes = 0;
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        ushort c = text[i].unicode();
+        if (c < 0x80) {
+            bytes += 1;
+        } else if (c < 0x800) {
+            bytes += 2;
+        } else if (QChar::isHighSurrogate(c) && i + 1 < text.size() && text[i + 1].isLowSurrogate()) {
+            bytes += 4;
+            ++i;
+        } else {
+            bytes += 3;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Collects paragraphs into segments, closing a segment when the next
+ * paragraph would push it over `maxSize` UTF-8 bytes or over `wordBudget`
+ * words (0: no word budget). Paragraphs themselves are never split: the
+ * mergers put translations back by paragraph id. Ids are handed out in the
+ * order paragraphs are added, starting at 0; segment indexes start at
+ * `firstIndex`.
+ */
+class SegmentBuilder {
+public:
+    SegmentBuilder(qint64 maxSize, int wordBudget, QList<DocumentSplitter::Segment> &segments, int firstIndex = 0)
+        : maxSize_(maxSize), wordBudget_(wordBudget), segments_(segments), chunkBytes_(0), chunkWords_(0), nextId_(0),
+          nextIndex_(firstIndex) {
+    }
+
+    void addParagraph(QStringView para) {
+        qint64 paraBytes = utf8Length(para);
+        int paraWords = DocumentSplitter::countWords(para);
+
+        bool overBudget = wordBudget_ > 0 && chunkWords_ > 0 && chunkWords_ + paraWords > wordBudget_;
+
+        if (!chunk_.isEmpty() && (chunkBytes_ + 1 + paraBytes > maxSize_ || overBudget)) {
+            // Adding this paragraph would exceed the limit: save current chunk
+            flush();
+        }
+
+        // Sizes count a newline between paragraphs, as the translation
+        // service would see them joined.
+        chunkBytes_ += (chunk_.isEmpty() ? 0 : 1) + paraBytes;
+        chunkWords_ += paraWords;
+        chunk_.append(DocumentSplitter::Paragraph{nextId_++, para.toString()});
+    }
+
+    // Don't forget the last chunk
+    void finish() {
+        if (!chunk_.isEmpty())
+            flush();
+    }
+
+private:
+    void flush() {
+        DocumentSplitter::Segment seg;
+        seg.paragraphs = chunk_;
+        seg.index = nextIndex_++;
+        seg.identifier = QString("segment_%1").arg(seg.index);
+        seg.originalSize = chunkBytes_;
+        seg.words = chunkWords_;
+        segments_.append(seg);
+        chunk_.clear();
+        chunkBytes_ = 0;
+        chunkWords_ = 0;
+    }
+
+    qint64 maxSize_;
+    int wordBudget_;
+    QList<DocumentSplitter::Segment> &segments_;
+    QVector<DocumentSplitter::Paragraph> chunk_;
+    qint64 chunkBytes_;
+    int chunkWords_;
+    int nextId_;
+    int nextIndex_;
+};
+
+bool isXhtmlEntry(const QString &name) {
+    return name.endsWith(".xhtml") || name.endsWith(".html");
+}
+
+#ifdef HAVE_POPPLER
+// Text blocks of a range of PDF pages
+struct PdfPages {
+    int last;       // The range ends before this page
+    bool opened;
+    QStringList blocks;
+};
+
+// Runs on the thread pool. A poppler::document can't be used from several
+// threads at once, so each range opens its own. One paragraph per text
+// block, so DocumentMerger can put each translation back where the block was.
+PdfPages readPdfPages(const std::string &path, int first, int last) {
+    PdfPages pages{last, false, {}};
+    std::unique_ptr<poppler::document> doc(poppler::document::load_from_file(path));
+    if (!doc)
+        return pages;
+
+    pages.opened = true;
+    for (int i = first; i < last; ++i) {
+        std::unique_ptr<poppler::page> page(doc->create_page(i));
+        if (page) {
+            for (const PdfLayout::Block &block : PdfLayout::readPage(*page).blocks)
+                pages.blocks.append(block.text);
+        }
+    }
+    return pages;
+}
+#endif
+
+} // Anonymous namespace
+
+// State of openStream(). Segments are built a paragraph (TXT), a chapter
+// (EPUB) or a range of pages (PDF) at a time, and kept in `ready` until
+// readSegment() takes them.
+struct DocumentSplitter::Stream {
+    bool epub = false;
+    QList<Segment> ready;
+    bool atEnd = false;
+    bool failed = false;
+
+    // TXT and PDF
+    std::unique_ptr<SegmentBuilder> builder;
+
+    // TXT
+    QFile file;
+    bool endsWithNewline = true; // An empty file is one empty paragraph
+
+#ifdef HAVE_POPPLER
+    // PDF: ranges of pages being extracted on the thread pool, in page order
+    bool pdf = false;
+    std::string path;
+    int pages = 0;
+    int nextPage = 0;       // First page not handed to the pool yet
+    int pagesPerJob = 1;
+    size_t maxExtracting = 1;
+    std::deque<std::future<PdfPages>> extracting;
+#endif
+
+    // EPUB
+    struct archive *archive = nullptr;
+    int nextIndex = 0;
+
+    ~Stream() {
+        if (archive)
+            archive_read_free(archive);
+    }
+};
+
+DocumentSplitter::~DocumentSplitter() = default;
+
+DocumentSplitter::DocumentSplitter(QObject *parent)
+    : QObject(parent), wordBudget_(DEFAULT_WORD_BUDGET) {}
+
+QString DocumentSplitter::Segment::text() const {
+    QString joined;
+    for (int i = 0; i < paragraphs.size(); ++i) {
+        if (i > 0)
+            joined += '\n';
+        joined += paragraphs[i].text;
+    }
+    return joined;
+}
+
+int DocumentSplitter::countWords(QStringView text) {
+    // Same definition as the word count MarianInterface uses to measure
+    // translation speed.
+    bool inSpaces = true;
+    int numWords = 0;
+
+    for (QChar c : text) {
+        if (c.isSpace()) {
+            inSpaces = true;
+        } else if (inSpaces) {
+            numWords++;
+            inSpaces = false;
+        }
+    }
+    return numWords;
+}
+
+void DocumentSplitter::setWordBudget(int words) {
+    wordBudget_ = words;
+}
+
+int DocumentSplitter::wordBudget() const {
+    return wordBudget_;
+}
 
 bool DocumentSplitter::needsSplitting(const QString &filePath) {
     return getFileSize(filePath) > MAX_SEGMENT_SIZE;
@@ -41,6 +249,8 @@ QList<DocumentSplitter::Segment> DocumentSplitter::splitDocument(const QString &
         return splitEpub(filePath);
     } else if (ext == "pdf") {
         return splitPdf(filePath);
+    } else if (const DocumentFormat *format = DocumentFormat::forPath(filePath)) {
+        return splitWithFormat(*format, filePath);
     }
 
     emit error(tr("Unsupported file format: %1").arg(ext));
@@ -61,42 +271,43 @@ QList<DocumentSplitter::Segment> DocumentSplitter::splitTxt(const QString &fileP
 }
 
 QList<DocumentSplitter::Segment> DocumentSplitter::splitTextByParagraphs(const QString &text, qint64 maxSize) {
+    // Single scan over `text`, handing each paragraph (line) to the builder
+    // as a view: paragraphs are only copied once, into their segment.
     QList<Segment> segments;
-    QStringList paragraphs = text.split('\n', Qt::KeepEmptyParts);
+    SegmentBuilder builder(maxSize, wordBudget_, segments);
 
-    QString currentChunk;
-    int segmentIndex = 0;
+    qsizetype pos = 0;
+    while (pos <= text.size()) {
+        qsizetype end = text.indexOf('\n', pos);
+        if (end < 0)
+            end = text.size();
 
-    for (const QString &para : paragraphs) {
-        // Check if adding this paragraph would exceed the limit
-        QString potentialChunk = currentChunk.isEmpty() ? para : currentChunk + "\n" + para;
-
-        if (potentialChunk.toUtf8().size() > maxSize && !currentChunk.isEmpty()) {
-            // Save current chunk as a segment
-            Segment seg;
-            seg.text = currentChunk;
-            seg.identifier = QString("segment_%1").arg(segmentIndex);
-            seg.index = segmentIndex;
-            seg.originalSize = currentChunk.toUtf8().size();
-            segments.append(seg);
-            segmentIndex++;
-
-            currentChunk = para;
-        } else {
-            currentChunk = potentialChunk;
-        }
+        builder.addParagraph(QStringView(text).mid(pos, end - pos));
+        pos = end + 1;
     }
+    builder.finish();
 
-    // Don't forget the last chunk
-    if (!currentChunk.isEmpty()) {
-        Segment seg;
-        seg.text = currentChunk;
-        seg.identifier = QString("segment_%1").arg(segmentIndex);
-        seg.index = segmentIndex;
-        seg.originalSize = currentChunk.toUtf8().size();
-        segments.append(seg);
+    emit progress(segments.size(), segments.size());
+    return segments;
+}
+
+QList<DocumentSplitter::Segment> DocumentSplitter::splitWithFormat(const DocumentFormat &format, const QString &filePath) {
+    qDebug() << "Start splitting" << format.name() << filePath;
+    QList<Segment> segments;
+    SegmentBuilder builder(MAX_SEGMENT_SIZE, wordBudget_, segments);
+
+    QString errorMessage;
+    if (!format.extract(filePath, [&](QStringView text) { builder.addParagraph(text); }, &errorMessage)) {
+        qWarning() << "Error reading" << format.name() << filePath << ":" << errorMessage;
+        emit error(tr("Error reading %1: %2").arg(format.name(), errorMessage));
+        return {};
     }
+    builder.finish();
+
+    for (auto &seg : segments)
+        seg.html = format.html();
 
+    qDebug() << "Extracted" << segments.size() << "segments from" << format.name();
     emit progress(segments.size(), segments.size());
     return segments;
 }
@@ -117,8 +328,9 @@ QList<DocumentSplitter::Segment> DocumentSplitter::splitDocx(const QString &file
     }
 
     struct archive_entry *entry;
-    QString fullText;
     bool foundDocument = false;
+    QString readError;
+    SegmentBuilder builder(MAX_SEGMENT_SIZE, wordBudget_, segments);
 
     while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
         QString name = QString::fromUtf8(archive_entry_pathname(entry));
@@ -126,32 +338,51 @@ QList<DocumentSplitter::Segment> DocumentSplitter::splitDocx(const QString &file
             foundDocument = true;
             qDebug() << "Found word/document.xml, extracting text...";
 
-            // Safe reading by chunks
-            QByteArray content;
-            char buffer[8192];
-            la_ssize_t len;
-            while ((len = archive_read_data(a, buffer, sizeof(buffer))) > 0) {
-                content.append(buffer, len);
-            }
-
-            if (len < 0) {
-                qWarning() << "Error extracting word/document.xml:" << archive_error_string(a);
-                break;
-            }
-
-            // Parse XML to extract paragraphs
-            QXmlStreamReader xml(content);
+            // The XML is parsed while it is being decompressed: each block
+            // read from the archive is fed to the reader, which only keeps
+            // what it has not parsed yet. A paragraph goes to its segment as
+            // soon as its </w:p> is seen.
+            QXmlStreamReader xml;
             QString currentPara;
-            while (!xml.atEnd()) {
-                xml.readNext();
-                if (xml.isStartElement() && xml.name().toString() == "t") {
-                    currentPara += xml.readElementText();
-                } else if (xml.isEndElement() && xml.name().toString() == "p") {
-                    if (!currentPara.isEmpty()) {
-                        fullText += currentPara + "\n";
-                        currentPara.clear();
+            bool inText = false;
+
+            const void *block;
+            size_t size;
+            la_int64_t offset;
+            int r;
+            while ((r = archive_read_data_block(a, &block, &size, &offset)) == ARCHIVE_OK) {
+                xml.addData(QByteArray::fromRawData(static_cast<const char *>(block), static_cast<int>(size)));
+
+                // Parse XML to extract paragraphs. Running out of data is
+                // expected until the last block.
+                while (!xml.atEnd()) {
+                    xml.readNext();
+                    if (xml.isStartElement() && xml.qualifiedName() == QLatin1String("w:t")) {
+                        inText = true;
+                    } else if (xml.isEndElement() && xml.qualifiedName() == QLatin1String("w:t")) {
+                        inText = false;
+                    } else if (xml.isCharacters() && inText) {
+                        currentPara.append(xml.text().data(), xml.text().size());
+                    } else if (xml.isEndElement() && xml.qualifiedName() == QLatin1String("w:p")) {
+                        if (!currentPara.isEmpty()) {
+                            builder.addParagraph(currentPara);
+                            currentPara.clear();
+                        }
                     }
                 }
+
+                if (xml.hasError() && xml.error() != QXmlStreamReader::PrematureEndOfDocumentError)
+                    break;
+            }
+
+            // Running out of data is an error too once there is no more:
+            // the document ends before its last element does.
+            if (r != ARCHIVE_EOF && r != ARCHIVE_OK) {
+                qWarning() << "Error extracting word/document.xml:" << archive_error_string(a);
+                readError = QString::fromUtf8(archive_error_string(a));
+            } else if (xml.hasError()) {
+                qWarning() << "Error parsing word/document.xml:" << xml.errorString();
+                readError = tr("%1 (line %2)").arg(xml.errorString()).arg(xml.lineNumber());
             }
             break;
         }
@@ -165,14 +396,25 @@ QList<DocumentSplitter::Segment> DocumentSplitter::splitDocx(const QString &file
         return {};
     }
 
-    qDebug() << "Extracted" << fullText.size() << "characters from DOCX. Splitting...";
-    // Split the full text into segments
-    return splitTextByParagraphs(fullText, MAX_SEGMENT_SIZE);
+    // Whatever was read before the error is not the whole document
+    if (!readError.isEmpty()) {
+        emit error(tr("Error reading DOCX %1: %2").arg(filePath, readError));
+        return {};
+    }
+
+    builder.finish();
+    qDebug() << "Extracted" << segments.size() << "segments from DOCX";
+    emit progress(segments.size(), segments.size());
+    return segments;
 }
 
 QList<DocumentSplitter::Segment> DocumentSplitter::splitEpub(const QString &filePath) {
+    // Single pass over the archive: chapter text is extracted (on the thread
+    // pool) while the rest of the archive is being decompressed, and the OPF
+    // package document tells us in which order chapters are read. Entries
+    // can come in any order (the OPF may well come after the chapters) so
+    // chapters are ordered afterwards.
     qDebug() << "Start splitting EPUB:" << filePath;
-    QList<Segment> segments;
     struct archive *a = archive_read_new();
     archive_read_support_format_all(a);
     archive_read_support_filter_all(a);
@@ -186,18 +428,55 @@ QList<DocumentSplitter::Segment> DocumentSplitter::splitEpub(const QString &file
     }
 
     struct archive_entry *entry;
-    int segmentIndex = 0;
-    QStringList chapterFiles;
+    QString rootfilePath;                 // OPF path according to META-INF/container.xml
+    QHash<QString, QStringList> spines;   // OPF path -> chapter paths in reading order
+    QStringList chapterFiles;             // Chapters in archive order
+    QHash<QString, QStringList> chapterBlocks; // Chapter path -> extracted blocks
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int maxPending = 2 * std::max(1, pool->maxThreadCount());
+    std::deque<std::pair<QString, std::future<QStringList>>> pending;
+
+    auto collect = [&]() {
+        chapterBlocks.insert(pending.front().first, pending.front().second.get());
+        pending.pop_front();
+    };
 
-    // First pass: collect all chapter files
-    qDebug() << "First pass: scanning for chapters...";
     while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
         QString name = QString::fromUtf8(archive_entry_pathname(entry));
-        if (name.endsWith(".xhtml") || name.endsWith(".html")) {
+
+        if (name == "META-INF/container.xml") {
+            QByteArray content;
+            if (readEntry(a, content))
+                rootfilePath = parseEpubContainer(content);
+        } else if (name.endsWith(".opf")) {
+            QByteArray content;
+            if (readEntry(a, content))
+                spines.insert(name, parseEpubSpine(content, name));
+        } else if (isXhtmlEntry(name)) {
+            qDebug() << "Processing chapter:" << name;
+            QByteArray content;
+            if (!readEntry(a, content)) {
+                qWarning() << "Error reading data from entry" << name << ":" << archive_error_string(a);
+                // Better to warn and try to salvage other chapters.
+                continue;
+            }
+
+            // Reading the archive is sequential, but chapters are independent
+            // so they are parsed on the thread pool. Only chapters still being
+            // parsed keep their XHTML in memory.
+            if (pending.size() >= static_cast<size_t>(maxPending))
+                collect();
             chapterFiles.append(name);
-            qDebug() << "Found chapter:" << name;
+            pending.emplace_back(name, translateLocally::runOnPool(pool, [content]() {
+                return extractXhtmlBlocks(content);
+            }));
         }
     }
+
+    while (!pending.empty())
+        collect();
+
     archive_read_free(a);
 
     if (chapterFiles.isEmpty()) {
@@ -206,214 +485,368 @@ QList<DocumentSplitter::Segment> DocumentSplitter::splitEpub(const QString &file
         return {};
     }
 
-    emit progress(0, chapterFiles.size());
+    // Reading order: spine first, then any content documents not in the spine
+    // (navigation documents and the like) in archive order.
+    QStringList order;
+    QSet<QString> seen;
+    QStringList spine = spines.value(rootfilePath, spines.isEmpty() ? QStringList() : spines.begin().value());
+    for (const QString &path : spine) {
+        if (chapterBlocks.contains(path) && !seen.contains(path)) {
+            order.append(path);
+            seen.insert(path);
+        }
+    }
+    for (const QString &path : chapterFiles) {
+        if (!seen.contains(path))
+            order.append(path);
+    }
+
+    QList<Segment> segments;
+    int segmentIndex = 0;
 
-    // Second pass: extract each chapter
-    qDebug() << "Second pass: extracting content...";
-    a = archive_read_new();
-    archive_read_support_format_all(a);
-    archive_read_support_filter_all(a);
+    for (int chapter = 0; chapter < order.size(); ++chapter) {
+        const QString &name = order[chapter];
+        QStringList blocks = chapterBlocks.take(name);
+
+        if (!blocks.isEmpty()) {
+            // Split the chapter into translation sized parts. Paragraph ids
+            // are block numbers within the chapter; the merger reads the
+            // XHTML again from the original file.
+            QList<Segment> chapterSegments;
+            SegmentBuilder builder(MAX_SEGMENT_SIZE, wordBudget_, chapterSegments);
+            for (const QString &block : blocks)
+                builder.addParagraph(block);
+            builder.finish();
+
+            for (int i = 0; i < chapterSegments.size(); i++) {
+                Segment seg = chapterSegments[i];
+                seg.identifier = chapterSegments.size() == 1 ? name : QString("%1_part%2").arg(name).arg(i);
+                seg.index = segmentIndex++;
+                seg.entry = name;
+                seg.html = true;
+                segments.append(seg);
+            }
+        }
 
-    if (archive_read_open_filename(a, filePath.toUtf8().constData(), 10240) != ARCHIVE_OK) {
-        QString err = QString::fromUtf8(archive_error_string(a));
-        qCritical() << "Error re-opening EPUB for extraction:" << err;
-        emit error(tr("Error reading EPUB: %1").arg(err));
-        archive_read_free(a);
-        return {};
+        emit progress(chapter + 1, order.size());
     }
 
-    while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
-        QString name = QString::fromUtf8(archive_entry_pathname(entry));
+    qDebug() << "Finished processing EPUB. Total segments:" << segments.size();
+    return segments;
+}
 
-        // Skip if not a chapter we want
-        if (!name.endsWith(".xhtml") && !name.endsWith(".html")) {
-            continue;
-        }
+bool DocumentSplitter::canStream(const QString &filePath) {
+    QString ext = QFileInfo(filePath).suffix().toLower();
+#ifdef HAVE_POPPLER
+    if (ext == "pdf")
+        return true;
+#endif
+    return ext == "txt" || ext == "epub";
+}
 
-        qDebug() << "Processing chapter:" << name;
+bool DocumentSplitter::openStream(const QString &filePath) {
+    stream_.reset(new Stream);
+    stream_->epub = QFileInfo(filePath).suffix().toLower() == "epub";
 
-        // Safer reading: read in chunks instead of relying on entry size
-        QByteArray content;
-        char buffer[8192];
-        la_ssize_t len;
+#ifdef HAVE_POPPLER
+    if (QFileInfo(filePath).suffix().toLower() == "pdf") {
+        std::unique_ptr<poppler::document> doc(poppler::document::load_from_file(filePath.toStdString()));
+        if (!doc || doc->is_locked()) {
+            emit error(tr("Could not open PDF file or PDF is locked: %1").arg(filePath));
+            stream_.reset();
+            return false;
+        }
 
-        while ((len = archive_read_data(a, buffer, sizeof(buffer))) > 0) {
-            content.append(buffer, len);
+        // Opening a document isn't free, so each job extracts a range of
+        // pages. Enough of them are kept going to keep the pool busy.
+        const int threads = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+        stream_->pdf = true;
+        stream_->path = filePath.toStdString();
+        stream_->pages = doc->pages();
+        stream_->pagesPerJob = std::max(8, stream_->pages / (4 * threads));
+        stream_->maxExtracting = 2 * threads;
+        stream_->builder.reset(new SegmentBuilder(MAX_SEGMENT_SIZE, wordBudget_, stream_->ready));
+        return true;
+    }
+#endif
+
+    if (!stream_->epub) {
+        stream_->file.setFileName(filePath);
+        if (!stream_->file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            emit error(tr("Could not open text file: %1").arg(filePath));
+            stream_.reset();
+            return false;
         }
+        stream_->builder.reset(new SegmentBuilder(MAX_SEGMENT_SIZE, wordBudget_, stream_->ready));
+        return true;
+    }
 
-        if (len < 0) {
-            QString err = QString::fromUtf8(archive_error_string(a));
-            qWarning() << "Error reading data from entry" << name << ":" << err;
-            // Continue to next file instead of aborting everything?
-            // Better to warn and try to salvage other chapters.
-            continue;
+    stream_->archive = archive_read_new();
+    archive_read_support_format_all(stream_->archive);
+    archive_read_support_filter_all(stream_->archive);
+    if (archive_read_open_filename(stream_->archive, filePath.toUtf8().constData(), 10240) != ARCHIVE_OK) {
+        emit error(tr("Error opening EPUB: %1").arg(QString::fromUtf8(archive_error_string(stream_->archive))));
+        stream_.reset();
+        return false;
+    }
+    return true;
+}
+
+bool DocumentSplitter::readSegment(Segment &segment) {
+    if (!stream_)
+        return false;
+
+    while (stream_->ready.isEmpty() && !stream_->atEnd)
+        readStream();
+
+    if (stream_->ready.isEmpty())
+        return false;
+
+    segment = stream_->ready.takeFirst();
+    return true;
+}
+
+bool DocumentSplitter::streamFailed() const {
+    return stream_ && stream_->failed;
+}
+
+void DocumentSplitter::closeStream() {
+    stream_.reset();
+}
+
+void DocumentSplitter::readStream() {
+    Stream &stream = *stream_;
+
+#ifdef HAVE_POPPLER
+    if (stream.pdf) {
+        // Pages are handed to the thread pool ahead of what is read, so they
+        // are extracted while the segments read before are being translated.
+        while (stream.nextPage < stream.pages && stream.extracting.size() < stream.maxExtracting) {
+            const std::string path = stream.path;
+            const int first = stream.nextPage;
+            const int last = std::min(first + stream.pagesPerJob, stream.pages);
+            stream.extracting.push_back(translateLocally::runOnPool(QThreadPool::globalInstance(), [path, first, last]() {
+                return readPdfPages(path, first, last);
+            }));
+            stream.nextPage = last;
         }
 
-        qDebug() << "Read" << content.size() << "bytes from" << name;
-
-        // Store original XHTML content
-        QString originalXhtml = QString::fromUtf8(content);
-
-        // Parse HTML to extract text, preserving paragraph structure
-        QString chapterText;
-        QString currentPara;
-        QXmlStreamReader xml(content);
-        while (!xml.atEnd()) {
-            xml.readNext();
-            if (xml.isCharacters()) {
-                QString text = xml.text().toString().trimmed();
-                if (!text.isEmpty()) {
-                    currentPara += text + " ";
-                }
-            } else if (xml.isEndElement()) {
-                QString tagName = xml.name().toString();
-                // Detect paragraph/heading end tags
-                if (tagName == "p" || tagName == "h1" || tagName == "h2" ||
-                    tagName == "h3" || tagName == "h4" || tagName == "h5" || tagName == "h6") {
-                    if (!currentPara.trimmed().isEmpty()) {
-                        chapterText += currentPara.trimmed() + "\n";
-                        currentPara.clear();
-                    }
-                }
-            }
-            if (xml.hasError()) {
-                 // Non-fatal, just log
-                 // qWarning() << "XML Parse error in" << name << ":" << xml.errorString();
+        int before = stream.ready.size();
+        if (stream.extracting.empty()) {
+            stream.builder->finish();
+            stream.atEnd = true;
+        } else {
+            PdfPages pages = stream.extracting.front().get();
+            stream.extracting.pop_front();
+            if (!pages.opened) {
+                emit error(tr("Could not open PDF file or PDF is locked: %1").arg(QString::fromStdString(stream.path)));
+                stream.failed = true;
+                stream.atEnd = true;
+                return;
             }
+            for (const QString &block : pages.blocks)
+                stream.builder->addParagraph(block);
+            emit progress(pages.last, stream.pages);
         }
-        // Add any remaining text
-        if (!currentPara.trimmed().isEmpty()) {
-            chapterText += currentPara.trimmed() + "\n";
+
+        // DocumentProcessor recognises PDFs read by Poppler by this
+        for (int i = before; i < stream.ready.size(); ++i)
+            stream.ready[i].identifier = QString("pdf_poppler_%1").arg(stream.ready[i].index);
+        return;
+    }
+#endif
+
+    if (!stream.epub) {
+        // Same paragraphs as splitTxt(): every line, including a last empty
+        // one after a final newline.
+        if (stream.file.atEnd()) {
+            if (stream.endsWithNewline)
+                stream.builder->addParagraph(QStringView());
+            stream.builder->finish();
+            stream.atEnd = true;
+            return;
         }
 
-        if (!chapterText.isEmpty()) {
-            // Check if this chapter needs further splitting
-            if (chapterText.toUtf8().size() > MAX_SEGMENT_SIZE) {
-                // Split large chapter - for now, store original XHTML in first part only
-                // This is a limitation: proper splitting would require DOM manipulation
-                qDebug() << "Chapter too large (" << chapterText.size() << "), splitting by paragraphs...";
-                QList<Segment> chapterSegments = splitTextByParagraphs(chapterText, MAX_SEGMENT_SIZE);
-                for (int i = 0; i < chapterSegments.size(); i++) {
-                    Segment seg = chapterSegments[i];
-                    seg.identifier = QString("%1_part%2").arg(name).arg(i);
-                    seg.index = segmentIndex++;
-                    // Store original XHTML only in first part (limitation of current approach)
-                    if (i == 0) {
-                        seg.originalXhtml = originalXhtml;
-                    }
-                    segments.append(seg);
-                }
-            } else {
-                Segment seg;
-                seg.text = chapterText.trimmed();
-                seg.identifier = name;
-                seg.index = segmentIndex++;
-                seg.originalSize = chapterText.toUtf8().size();
-                seg.originalXhtml = originalXhtml;  // Store original XHTML structure
-                segments.append(seg);
-            }
+        QByteArray line = stream.file.readLine();
+        stream.endsWithNewline = line.endsWith('\n');
+        if (stream.endsWithNewline)
+            line.chop(1);
+        stream.builder->addParagraph(QString::fromUtf8(line));
+        return;
+    }
 
-            emit progress(segmentIndex, chapterFiles.size());
+    // EPUB: content documents in archive order, so DocumentMerger can write
+    // the output in a single pass over the original as well.
+    struct archive_entry *entry;
+    int r = archive_read_next_header(stream.archive, &entry);
+    if (r != ARCHIVE_OK) {
+        if (r != ARCHIVE_EOF) {
+            emit error(tr("Error reading EPUB: %1").arg(QString::fromUtf8(archive_error_string(stream.archive))));
+            stream.failed = true;
         }
+        stream.atEnd = true;
+        return;
     }
 
-    archive_read_free(a);
-    qDebug() << "Finished processing EPUB. Total segments:" << segments.size();
-    return segments;
-}
+    QString name = QString::fromUtf8(archive_entry_pathname(entry));
+    if (!isXhtmlEntry(name))
+        return;
 
-QString DocumentSplitter::findLibreOfficePath() {
-#ifdef Q_OS_WIN
-    // Common Windows paths for LibreOffice
-    QStringList possiblePaths = {
-        "C:/Program Files/LibreOffice/program/soffice.exe",
-        "C:/Program Files (x86)/LibreOffice/program/soffice.exe",
-        QStandardPaths::findExecutable("soffice"),
-        QStandardPaths::findExecutable("soffice.exe")
-    };
+    QByteArray content;
+    if (!readEntry(stream.archive, content)) {
+        emit error(tr("Error reading %1 from EPUB: %2").arg(name, QString::fromUtf8(archive_error_string(stream.archive))));
+        stream.failed = true;
+        stream.atEnd = true;
+        return;
+    }
 
-    for (const QString &path : possiblePaths) {
-        if (!path.isEmpty() && QFile::exists(path)) {
-            return path;
-        }
+    // Paragraph ids are block numbers within the chapter, as in splitEpub()
+    QList<Segment> chapterSegments;
+    SegmentBuilder builder(MAX_SEGMENT_SIZE, wordBudget_, chapterSegments, stream.nextIndex);
+    for (const QString &block : extractXhtmlBlocks(content))
+        builder.addParagraph(block);
+    builder.finish();
+
+    for (int i = 0; i < chapterSegments.size(); i++) {
+        Segment &seg = chapterSegments[i];
+        seg.identifier = chapterSegments.size() == 1 ? name : QString("%1_part%2").arg(name).arg(i);
+        seg.entry = name;
+        seg.html = true;
     }
-#elif defined(Q_OS_MAC)
-    QStringList possiblePaths = {
-        "/Applications/LibreOffice.app/Contents/MacOS/soffice",
-        QStandardPaths::findExecutable("soffice")
+    stream.nextIndex += chapterSegments.size();
+    stream.ready += chapterSegments;
+}
+
+bool DocumentSplitter::readEntry(struct archive *a, QByteArray &content) {
+    char buffer[8192];
+    la_ssize_t len;
+    while ((len = archive_read_data(a, buffer, sizeof(buffer))) > 0) {
+        content.append(buffer, len);
+    }
+    return len == 0;
+}
+
+QVector<DocumentSplitter::XhtmlBlock> DocumentSplitter::findXhtmlBlocks(const QString &xhtml) {
+    auto isBlock = [](QStringView tagName) {
+        return tagName == u"p" || tagName == u"h1" || tagName == u"h2" || tagName == u"h3" ||
+               tagName == u"h4" || tagName == u"h5" || tagName == u"h6" || tagName == u"li" ||
+               tagName == u"dt" || tagName == u"dd" || tagName == u"td" || tagName == u"th" ||
+               tagName == u"caption" || tagName == u"figcaption";
     };
 
-    for (const QString &path : possiblePaths) {
-        if (!path.isEmpty() && QFile::exists(path)) {
-            return path;
+    QVector<XhtmlBlock> blocks;
+
+    // The reader works on the decoded document, so characterOffset() is an
+    // index into `xhtml`. The offset after the previous token is where the
+    // current one starts.
+    QXmlStreamReader xml(xhtml);
+    xml.setNamespaceProcessing(false);
+    qint64 tokenStart = 0;
+    int depth = 0;        // Elements open inside the current block
+    bool inBlock = false;
+    bool hasText = false;
+    XhtmlBlock block = {0, 0};
+
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (xml.hasError())
+            break;
+
+        if (xml.isStartElement()) {
+            if (inBlock) {
+                depth++;
+            } else if (isBlock(xml.name())) {
+                inBlock = true;
+                hasText = false;
+                depth = 0;
+                block.begin = static_cast<int>(xml.characterOffset());
+            }
+        } else if (xml.isEndElement() && inBlock) {
+            if (depth > 0) {
+                depth--;
+            } else {
+                inBlock = false;
+                block.end = static_cast<int>(tokenStart);
+                if (hasText && block.end > block.begin)
+                    blocks.append(block);
+            }
+        } else if (xml.isCharacters() && inBlock && !xml.isWhitespace()) {
+            hasText = true;
         }
-    }
-#else
-    // Linux
-    QString path = QStandardPaths::findExecutable("soffice");
-    if (!path.isEmpty()) return path;
 
-    path = QStandardPaths::findExecutable("libreoffice");
-    if (!path.isEmpty()) return path;
-#endif
+        tokenStart = xml.characterOffset();
+    }
 
-    return QString();
+    return blocks;
 }
 
-bool DocumentSplitter::isLibreOfficeAvailable() {
-    return !findLibreOfficePath().isEmpty();
-}
+QStringList DocumentSplitter::extractXhtmlBlocks(const QByteArray &content) {
+    // The inner HTML of each block, so inline markup (<em>, <a>...) can go
+    // through the translation service's HTML mode. Whitespace is collapsed as
+    // a browser would.
+    QString xhtml = QString::fromUtf8(content);
+    QStringList blocks;
 
-QString DocumentSplitter::convertPdfToDocx(const QString &pdfPath) {
-    QString sofficePath = findLibreOfficePath();
-    if (sofficePath.isEmpty()) {
-        emit error(tr("LibreOffice not found. Please install LibreOffice to convert PDF files. "
-                      "Download from: https://www.libreoffice.org/download/"));
-        return QString();
+    for (const XhtmlBlock &block : findXhtmlBlocks(xhtml)) {
+        blocks.append(xhtml.mid(block.begin, block.end - block.begin).simplified());
     }
 
-    // Create temporary output directory
-    QTemporaryDir tempDir;
-    if (!tempDir.isValid()) {
-        emit error(tr("Could not create temporary directory for PDF conversion."));
-        return QString();
+    return blocks;
+}
+
+QString DocumentSplitter::parseEpubContainer(const QByteArray &content) {
+    QXmlStreamReader xml(content);
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (xml.isStartElement() && xml.name() == QLatin1String("rootfile"))
+            return xml.attributes().value("full-path").toString();
     }
-    tempDir.setAutoRemove(false);
+    return QString();
+}
 
-    // Run LibreOffice conversion: pdf -> docx
-    QProcess process;
-    QStringList args;
-    args << "--headless"
-         << "--convert-to" << "docx"
-         << "--outdir" << tempDir.path()
-         << pdfPath;
+QStringList DocumentSplitter::parseEpubSpine(const QByteArray &content, const QString &opfPath) {
+    // Manifest hrefs are relative to the package document
+    QString baseDir = QFileInfo(opfPath).path();
+    auto resolve = [&](const QString &href) {
+        QString path = QUrl::fromPercentEncoding(href.section('#', 0, 0).toUtf8());
+        return QDir::cleanPath(baseDir == "." ? path : baseDir + "/" + path);
+    };
 
-    process.start(sofficePath, args);
-    if (!process.waitForStarted(30000)) {
-        emit error(tr("Failed to start LibreOffice for PDF conversion."));
-        return QString();
-    }
+    QHash<QString, QString> manifest; // id -> archive path
+    QStringList spine;
 
-    if (!process.waitForFinished(300000)) { // 5 minutes timeout for large PDFs
-        emit error(tr("LibreOffice PDF conversion timed out."));
-        process.kill();
-        return QString();
-    }
+    QXmlStreamReader xml(content);
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (!xml.isStartElement())
+            continue;
 
-    if (process.exitCode() != 0) {
-        emit error(tr("LibreOffice conversion failed: %1").arg(QString(process.readAllStandardError())));
-        return QString();
+        if (xml.name() == QLatin1String("item")) {
+            QXmlStreamAttributes attrs = xml.attributes();
+            manifest.insert(attrs.value("id").toString(), resolve(attrs.value("href").toString()));
+        } else if (xml.name() == QLatin1String("itemref")) {
+            // The manifest always precedes the spine in a package document
+            QString path = manifest.value(xml.attributes().value("idref").toString());
+            if (!path.isEmpty())
+                spine.append(path);
+        }
     }
 
-    // Find the output file
-    QFileInfo pdfInfo(pdfPath);
-    QString outputPath = tempDir.path() + "/" + pdfInfo.completeBaseName() + ".docx";
+    return spine;
+}
 
-    if (!QFile::exists(outputPath)) {
-        emit error(tr("PDF conversion produced no output file."));
-        return QString();
-    }
+bool DocumentSplitter::isLibreOfficeAvailable() {
+    return !LibreOfficeConverter::sofficePath().isEmpty();
+}
 
+QString DocumentSplitter::convertPdfToDocx(const QString &pdfPath) {
+    // Goes through the shared converter, which keeps its LibreOffice profile
+    // around instead of creating a new one for every conversion.
+    QString message;
+    QString outputPath = LibreOfficeConverter::instance()->convert(pdfPath, "docx", &message);
+    if (outputPath.isEmpty()) {
+        emit error(message);
+    }
     return outputPath;
 }
 
@@ -449,48 +882,25 @@ QList<DocumentSplitter::Segment> DocumentSplitter::splitPdf(const QString &fileP
 
 #ifdef HAVE_POPPLER
 QList<DocumentSplitter::Segment> DocumentSplitter::splitPdfWithPoppler(const QString &filePath) {
-    // Load PDF document using Poppler C++ API (no Qt dependency)
-    std::unique_ptr<poppler::document> doc(poppler::document::load_from_file(filePath.toStdString()));
-
-    if (!doc || doc->is_locked()) {
-        emit error(tr("Could not open PDF file or PDF is locked: %1").arg(filePath));
+    // The stream, read to the end: ranges of pages are extracted on the
+    // thread pool and their blocks collected in page order.
+    if (!openStream(filePath))
         return {};
-    }
-
-    // Extract text from all pages
-    QString fullText;
-    int numPages = doc->pages();
-
-    for (int i = 0; i < numPages; ++i) {
-        std::unique_ptr<poppler::page> page(doc->create_page(i));
-        if (page) {
-            // Extract text as UTF-8 byte vector
-            std::vector<char> text_bytes = page->text().to_utf8();
 
-            // Convert to QString
-            std::string text_str(text_bytes.begin(), text_bytes.end());
-            QString pageText = QString::fromStdString(text_str);
-
-            fullText += pageText;
-            fullText += "\n\n";  // Separate pages
-        }
-
-        emit progress(i + 1, numPages);
-    }
+    QList<Segment> segments;
+    Segment segment;
+    while (readSegment(segment))
+        segments.append(segment);
+    bool failed = streamFailed();
+    closeStream();
+    if (failed)
+        return {};
 
-    if (fullText.trimmed().isEmpty()) {
+    if (segments.isEmpty()) {
         emit error(tr("No text found in PDF document."));
         return {};
     }
 
-    // Split the extracted text by paragraphs
-    QList<Segment> segments = splitTextByParagraphs(fullText, MAX_SEGMENT_SIZE);
-
-    // Update identifiers to indicate PDF source
-    for (int i = 0; i < segments.size(); i++) {
-        segments[i].identifier = QString("pdf_poppler_%1").arg(i);
-    }
-
     qDebug() << "Extracted" << segments.size() << "segments from PDF using Poppler";
     return segments;
 }
@@ -4,26 +4,89 @@
 #include <QString>
 #include <QObject>
 #include <QList>
+#include <QStringList>
+#include <QVector>
+#include <QStringView>
+#include <memory>
+
+struct archive;
+class DocumentFormat;
 
 class DocumentSplitter : public QObject {
     Q_OBJECT
 public:
     explicit DocumentSplitter(QObject *parent = nullptr);
+    ~DocumentSplitter();
+
+    // Unit of translation: a paragraph, heading, text block... Translated on
+    // its own and put back by id, which is its position in the document (for
+    // EPUB: in the chapter it came from).
+    struct Paragraph {
+        int id;
+        QString text;
+    };
 
     struct Segment {
-        QString text;           // Text to translate
+        QVector<Paragraph> paragraphs; // Text to translate, in document order
         QString identifier;     // For reassembly (chapter name, page number, etc.)
         int index;              // Order index
         qint64 originalSize;    // Size in bytes before translation
-        QString originalXhtml;  // Original XHTML structure (for EPUB/HTML files)
+        QString entry;          // Archive entry the text was taken from (EPUB)
+        bool html = false;      // Each paragraph is the inner HTML of one block (EPUB)
+        int words = 0;          // Words in all paragraphs, see countWords()
+        bool refined = false;   // Translation was improved by the LLM (set by DocumentTranslationEngine)
+
+        // All paragraphs, one per line
+        QString text() const;
     };
 
+    // Content of a block element (paragraph, heading...) of an XHTML document:
+    // the characters between its start and end tag.
+    struct XhtmlBlock {
+        int begin;
+        int end;
+    };
+
+    // Blocks of `xhtml` that contain text, in document order. A block inside
+    // another block is part of the outer one. Shared with DocumentMerger so
+    // splitting and merging agree on what a paragraph is.
+    static QVector<XhtmlBlock> findXhtmlBlocks(const QString &xhtml);
+
     // Split a document into translatable segments
     QList<Segment> splitDocument(const QString &filePath);
 
+    /**
+     * Streaming alternative to splitDocument(), for TXT, EPUB and (with
+     * Poppler) PDF: segments are read from the file one at a time, so only
+     * the current paragraph (TXT), chapter (EPUB) or a few ranges of pages
+     * (PDF) are held in memory. EPUB chapters come in archive order rather
+     * than reading order. PDF pages are extracted on the thread pool ahead of
+     * readSegment(), so extraction overlaps with whatever the caller does
+     * with the segments. readSegment() returns false at the end of the
+     * document, or on error (after emitting error(); see streamFailed()).
+     */
+    static bool canStream(const QString &filePath);
+    bool openStream(const QString &filePath);
+    bool readSegment(Segment &segment);
+    bool streamFailed() const;
+    void closeStream();
+
     // Maximum segment size (8MB for safety margin under 10MB limit)
     static constexpr qint64 MAX_SEGMENT_SIZE = 8 * 1024 * 1024;
 
+    // Default number of words per segment. Small segments keep progress
+    // fine-grained and let many of them be translated in parallel.
+    static constexpr int DEFAULT_WORD_BUDGET = 1000;
+
+    // Segments are cut at the first paragraph boundary that would take them
+    // over this many words (in addition to MAX_SEGMENT_SIZE). 0 disables the
+    // word budget so only the size limit applies.
+    void setWordBudget(int words);
+    int wordBudget() const;
+
+    // Number of whitespace separated words in `text`
+    static int countWords(QStringView text);
+
     // Check if a document needs splitting
     static bool needsSplitting(const QString &filePath);
 
@@ -41,18 +104,30 @@ private:
     QList<Segment> splitDocx(const QString &filePath);
     QList<Segment> splitEpub(const QString &filePath);
     QList<Segment> splitPdf(const QString &filePath);  // Uses LibreOffice conversion
+    QList<Segment> splitWithFormat(const DocumentFormat &format, const QString &filePath);
+
+    // EPUB helpers
+    static bool readEntry(struct archive *a, QByteArray &content);
+    static QStringList extractXhtmlBlocks(const QByteArray &content);
+    static QString parseEpubContainer(const QByteArray &content);
+    static QStringList parseEpubSpine(const QByteArray &content, const QString &opfPath);
+
+    struct Stream;
+    void readStream();
 
     // Helper: split text into chunks by paragraph boundaries
     QList<Segment> splitTextByParagraphs(const QString &text, qint64 maxSize);
 
     // LibreOffice integration for PDF
     QString convertPdfToDocx(const QString &pdfPath);
-    QString findLibreOfficePath();
 
 #ifdef HAVE_POPPLER
     // Poppler integration for direct PDF text extraction
     QList<Segment> splitPdfWithPoppler(const QString &filePath);
 #endif
+
+    int wordBudget_;
+    std::unique_ptr<Stream> stream_;
 };
 
 #endif // DOCUMENTSPLITTER_H
@@ -3,26 +3,130 @@
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QMessageBox>
-#include <QEventLoop>
 
 // Worker Implementation
 DocumentTranslationWorker::DocumentTranslationWorker(
     const QString &inputPath, const QString &outputPath,
-    Settings *settings, MarianInterface *translator)
+    Settings *settings, MarianInterface *translator,
+    const QString &sourceLanguage, const QString &targetLanguage)
     : inputPath_(inputPath), outputPath_(outputPath),
-      settings_(settings), translator_(translator), cancelled_(false) {
+      settings_(settings), translator_(translator),
+      sourceLanguage_(sourceLanguage), targetLanguage_(targetLanguage), cancelled_(false) {
     llm_ = new LLMInterface(settings_, this);
+    engine_ = new DocumentTranslationEngine(translator_, this);
+    subtitles_ = new SubtitleTranslator(translator_, this);
 }
 
 void DocumentTranslationWorker::cancel() {
     cancelled_ = true;
-    if (llm_) llm_->cancelVerification();
+    engine_->cancel();
+    subtitles_->cancel();
+
+    // Called from the GUI thread, but the LLM requests belong to the worker's
+    if (llm_)
+        QMetaObject::invokeMethod(llm_, &LLMInterface::cancelVerification, Qt::QueuedConnection);
 }
 
 void DocumentTranslationWorker::process() {
     emit started();
 
     DocumentProcessor processor(inputPath_, outputPath_);
+    processor.setWordBudget(settings_->documentSegmentWords());
+
+    // Subtitles are translated a sentence at a time and put back in their cues
+    if (DocumentProcessor::isSubtitles(inputPath_)) {
+        connect(subtitles_, &SubtitleTranslator::progress, this, [this](int completed, int total) {
+            emit translationProgress(completed, total, tr("Translated %1 of %2 subtitles...").arg(completed).arg(total));
+        });
+        connect(subtitles_, &SubtitleTranslator::error, this, &DocumentTranslationWorker::error);
+
+        bool ok = processor.translateSubtitles(*subtitles_);
+        if (cancelled_)
+            emit finished(false, tr("Translation cancelled"));
+        else if (ok)
+            emit finished(true, tr("Successfully saved to: %1").arg(outputPath_));
+        else
+            emit finished(false, tr("Translation failed"));
+        return;
+    }
+
+    bool useAI = settings_->llmEnabled();
+
+    // Paragraphs that haven't changed since the last translation of this
+    // document (with the same model) are taken from its manifest.
+    if (settings_->documentReuseTranslations()) {
+        processor.enableManifest(translator_->model(),
+            useAI ? settings_->llmProvider() + "/" + settings_->llmModel() : QString());
+    }
+
+    // Paragraphs translated before in any document come from the memory
+    if (settings_->documentTranslationMemory() && !sourceLanguage_.isEmpty() && !targetLanguage_.isEmpty()) {
+        processor.enableTranslationMemory(sourceLanguage_, targetLanguage_,
+            settings_->documentFuzzyMatchPercent() / 100.0);
+    }
+
+    // Machine translate segments concurrently and, if enabled, let the LLM
+    // improve each one while the following ones are still being translated.
+    engine_->setRefiner(useAI ? llm_ : nullptr);
+
+    // Progress in words, so it moves within long segments too. The total is
+    // unknown (-1) while a document is streamed.
+    connect(engine_, &DocumentTranslationEngine::wordProgress, this,
+        [this](qint64 completed, qint64 total, double wordsPerSecond, qint64 etaSeconds) {
+            QString status = total < 0
+                ? tr("Translated %1 words").arg(completed)
+                : tr("Translated %1 of %2 words").arg(completed).arg(total);
+            if (etaSeconds >= 0) {
+                status += tr(" (%1 words/s, %2 left)").arg(qRound(wordsPerSecond))
+                    .arg(ProgressMeter::formatDuration(etaSeconds));
+            } else if (wordsPerSecond > 0) {
+                status += tr(" (%1 words/s)").arg(qRound(wordsPerSecond));
+            }
+            emit translationProgress(static_cast<int>(completed), static_cast<int>(total), status);
+        });
+    connect(engine_, &DocumentTranslationEngine::refinementProgress, this,
+        [this](int segment, int total, int completedChunks, int totalChunks) {
+            QString status;
+            if (total < 0) {
+                status = tr("AI improving segment %1...").arg(segment);
+            } else if (totalChunks == 0) {
+                status = tr("AI improving segment %1 of %2...").arg(segment).arg(total);
+            } else {
+                status = tr("AI improving segment %1 of %2 (chunk %3/%4)...")
+                    .arg(segment).arg(total).arg(completedChunks).arg(totalChunks);
+            }
+            if (llm_->cachedChunks() > 0)
+                status += tr(" [%1 chunks from cache]").arg(llm_->cachedChunks());
+            if (llm_->skippedSentences() > 0)
+                status += tr(" [%1 sentences kept as translated]").arg(llm_->skippedSentences());
+            emit llmProgress(segment - 1, total, status);
+        });
+    connect(engine_, &DocumentTranslationEngine::refinementError, this, [this](QString msg) {
+        emit error(tr("AI error: %1").arg(msg));
+    });
+    connect(engine_, &DocumentTranslationEngine::error, this, &DocumentTranslationWorker::error);
+
+    // Large TXT and EPUB files, and PDFs, are translated and written while
+    // they are read, instead of being held in memory whole.
+    if (DocumentProcessor::shouldStream(inputPath_)) {
+        bool ok = processor.translateStreaming(*engine_);
+        if (useAI) {
+            if (ok && !cancelled_)
+                emit llmProgress(1, 1, tr("AI improvement complete"));
+            else
+                emit llmProgress(0, 1, cancelled_ ? tr("AI improvement cancelled") : tr("AI improvement stopped: translation failed"));
+        }
+
+        if (cancelled_) {
+            emit finished(false, tr("Translation cancelled"));
+        } else if (ok) {
+            emit finished(true, tr("Successfully saved to: %1 (reused %2 translated paragraphs, %3 fuzzy matches to review)")
+                .arg(outputPath_).arg(processor.reusedParagraphs()).arg(processor.fuzzyMatches().size()));
+        } else {
+            emit finished(false, tr("Translation failed"));
+        }
+        return;
+    }
 
     if (!processor.open()) {
         emit error(tr("Failed to open document: %1").arg(inputPath_));
@@ -30,102 +134,41 @@ void DocumentTranslationWorker::process() {
         return;
     }
 
-    QList<DocumentSplitter::Segment> segments = processor.getSegments();
-    if (segments.isEmpty()) {
+    if (processor.getSegments().isEmpty()) {
         emit error(tr("No text found in document"));
         emit finished(false, tr("Document is empty"));
         return;
     }
 
-    QList<DocumentSplitter::Segment> translatedSegments;
-    int total = segments.size();
-    bool useAI = settings_->llmEnabled();
+    QList<DocumentSplitter::Segment> segments = processor.getPendingSegments();
+    if (processor.reusedParagraphs() > 0 || !processor.fuzzyMatches().isEmpty()) {
+        emit translationProgress(0, segments.size(),
+            tr("Reused %1 translated paragraphs, %2 fuzzy matches to review")
+                .arg(processor.reusedParagraphs()).arg(processor.fuzzyMatches().size()));
+    }
 
-    for (int i = 0; i < segments.size() && !cancelled_; ++i) {
-        const auto &seg = segments[i];
-        emit translationProgress(i + 1, total,
-            tr("Translating segment %1 of %2...").arg(i + 1).arg(total));
-
-        // Use event loop to wait for translation
-        QEventLoop loop;
-        bool translationDone = false;
-        QString translatedText;
-
-        QMetaObject::Connection conn = QObject::connect(
-            translator_, &MarianInterface::translationReady,
-            [&](Translation t) {
-                translatedText = t.translation();
-                translationDone = true;
-                loop.quit();
-            });
-
-        QMetaObject::Connection errConn = QObject::connect(
-            translator_, &MarianInterface::error,
-            [&](QString msg) {
-                emit error(msg);
-                loop.quit();
-            });
-
-        translator_->translate(seg.text, false);
-        loop.exec();
-
-        QObject::disconnect(conn);
-        QObject::disconnect(errConn);
-
-        if (cancelled_) break;
-
-        DocumentSplitter::Segment transSeg = seg;
-        transSeg.text = translatedText;
-
-        // AI improvement if enabled
-        if (useAI && !translatedText.isEmpty()) {
-            emit llmProgress(0, 100,
-                tr("AI improving segment %1 of %2...").arg(i + 1).arg(total));
-
-            QEventLoop aiLoop;
-
-            // Connect to chunk-level progress updates
-            QMetaObject::Connection aiProgress = QObject::connect(
-                llm_, &LLMInterface::verificationProgress,
-                [&](int completed, int totalChunks) {
-                    int percentage = (totalChunks > 0) ? (completed * 100 / totalChunks) : 0;
-                    emit llmProgress(percentage, 100,
-                        tr("AI improving segment %1 of %2 (chunk %3/%4)...")
-                            .arg(i + 1).arg(total).arg(completed).arg(totalChunks));
-                });
-
-            QMetaObject::Connection aiConn = QObject::connect(
-                llm_, &LLMInterface::verificationReady,
-                [&](QString suggestion) {
-                    if (!suggestion.isEmpty()) {
-                        transSeg.text = suggestion;
-                    }
-                    aiLoop.quit();
-                });
-
-            QMetaObject::Connection aiErr = QObject::connect(
-                llm_, &LLMInterface::error,
-                [&](QString msg) {
-                    emit error(tr("AI error: %1").arg(msg));
-                    aiLoop.quit();
-                });
-
-            llm_->verifyTranslation(seg.text, translatedText);
-            aiLoop.exec();
-
-            QObject::disconnect(aiProgress);
-            QObject::disconnect(aiConn);
-            QObject::disconnect(aiErr);
+    // Nothing to translate if the whole document came from the manifest
+    QList<DocumentSplitter::Segment> translatedSegments;
+    if (!segments.isEmpty()) {
+        translatedSegments = engine_->translate(segments);
+        if (translatedSegments.isEmpty() && !cancelled_) {
+            if (useAI)
+                emit llmProgress(0, 1, tr("AI improvement stopped: translation failed"));
+            emit finished(false, tr("Translation failed"));
+            return;
         }
-
-        translatedSegments.append(transSeg);
     }
 
     if (cancelled_) {
+        if (useAI)
+            emit llmProgress(0, 1, tr("AI improvement cancelled"));
         emit finished(false, tr("Translation cancelled"));
         return;
     }
 
+    if (useAI)
+        emit llmProgress(translatedSegments.size(), translatedSegments.size(), tr("AI improvement complete"));
+
     processor.setTranslatedSegments(translatedSegments);
     if (processor.save()) {
         emit finished(true, tr("Successfully saved to: %1").arg(outputPath_));
@@ -138,9 +181,11 @@ void DocumentTranslationWorker::process() {
 // Dialog Implementation
 DocumentTranslationDialog::DocumentTranslationDialog(
     const QString &inputPath, Settings *settings,
-    MarianInterface *translator, QWidget *parent)
+    MarianInterface *translator, const QString &sourceLanguage,
+    const QString &targetLanguage, QWidget *parent)
     : QDialog(parent), ui_(new Ui::DocumentTranslationDialog),
       inputPath_(inputPath), settings_(settings), translator_(translator),
+      sourceLanguage_(sourceLanguage), targetLanguage_(targetLanguage),
       workerThread_(nullptr), worker_(nullptr), isRunning_(false) {
 
     ui_->setupUi(this);
@@ -183,7 +228,11 @@ void DocumentTranslationDialog::onBrowseOutput() {
     QFileInfo info(inputPath_);
     QString filter;
     if (info.suffix().toLower() == "pdf") {
+#ifdef HAVE_POPPLER
+        filter = tr("PDF Documents (*.pdf);;Web Pages (*.html);;Text Files (*.txt)");
+#else
         filter = tr("Word Documents (*.docx)");
+#endif
     } else {
         filter = tr("Documents (*.%1)").arg(info.suffix());
     }
@@ -213,7 +262,8 @@ void DocumentTranslationDialog::onStartTranslation() {
     ui_->outputFileEdit->setEnabled(false);
 
     workerThread_ = new QThread(this);
-    worker_ = new DocumentTranslationWorker(inputPath_, outputPath, settings_, translator_);
+    worker_ = new DocumentTranslationWorker(inputPath_, outputPath, settings_, translator_,
+                                            sourceLanguage_, targetLanguage_);
     worker_->moveToThread(workerThread_);
 
     connect(workerThread_, &QThread::started, worker_, &DocumentTranslationWorker::process);
@@ -239,13 +289,14 @@ void DocumentTranslationDialog::onCancel() {
 }
 
 void DocumentTranslationDialog::onTranslationProgress(int current, int total, QString status) {
-    ui_->translationProgress->setMaximum(total);
+    // Busy indicator when the total isn't known
+    ui_->translationProgress->setMaximum(qMax(total, 0));
     ui_->translationProgress->setValue(current);
     ui_->translationProgressLabel->setText(status);
 }
 
 void DocumentTranslationDialog::onLLMProgress(int current, int total, QString status) {
-    ui_->llmProgress->setMaximum(total);
+    ui_->llmProgress->setMaximum(qMax(total, 0));
     ui_->llmProgress->setValue(current);
     ui_->llmProgressLabel->setText(status);
 }
@@ -3,10 +3,13 @@
 
 #include <QDialog>
 #include <QThread>
+#include <atomic>
 #include "DocumentProcessor.h"
 #include "DocumentSplitter.h"
+#include "DocumentTranslationEngine.h"
 #include "LLMInterface.h"
 #include "MarianInterface.h"
+#include "SubtitleTranslator.h"
 #include "settings/Settings.h"
 
 namespace Ui {
@@ -17,7 +20,8 @@ class DocumentTranslationWorker : public QObject {
     Q_OBJECT
 public:
     DocumentTranslationWorker(const QString &inputPath, const QString &outputPath,
-                              Settings *settings, MarianInterface *translator);
+                              Settings *settings, MarianInterface *translator,
+                              const QString &sourceLanguage, const QString &targetLanguage);
 
 public slots:
     void process();
@@ -35,16 +39,24 @@ private:
     QString outputPath_;
     Settings *settings_;
     MarianInterface *translator_;
+    QString sourceLanguage_;
+    QString targetLanguage_;
     LLMInterface *llm_;
-    bool cancelled_;
+    DocumentTranslationEngine *engine_;
+    SubtitleTranslator *subtitles_;
+    std::atomic<bool> cancelled_;
 };
 
 class DocumentTranslationDialog : public QDialog {
     Q_OBJECT
 public:
+    // The languages (BCP-47) of the current model select the translation
+    // memory; it is not used if they are empty.
     explicit DocumentTranslationDialog(const QString &inputPath,
                                        Settings *settings,
                                        MarianInterface *translator,
+                                       const QString &sourceLanguage,
+                                       const QString &targetLanguage,
                                        QWidget *parent = nullptr);
     ~DocumentTranslationDialog();
 
@@ -62,6 +74,8 @@ private:
     QString inputPath_;
     Settings *settings_;
     MarianInterface *translator_;
+    QString sourceLanguage_;
+    QString targetLanguage_;
     QThread *workerThread_;
     DocumentTranslationWorker *worker_;
     bool isRunning_;
@@ -0,0 +1,361 @@
+#include "DocumentTranslationEngine.h"
+#include "MarianInterface.h"
+#include "LLMInterface.h"
+#include <QEventLoop>
+#include <QDebug>
+#include <algorithm>
+
+DocumentTranslationEngine::DocumentTranslationEngine(MarianInterface *translator, QObject *parent)
+    : QObject(parent), translator_(translator), llm_(nullptr), window_(DEFAULT_WINDOW),
+      total_(0), first_(0), active_(0), nextRefine_(0), refineFailed_(false), translated_(0), refineGeneration_(0),
+      exhausted_(false), failed_(false), cancelled_(false), loop_(nullptr) {
+}
+
+void DocumentTranslationEngine::setWindow(int segments) {
+    window_ = std::max(1, segments);
+}
+
+int DocumentTranslationEngine::window() const {
+    return window_;
+}
+
+void DocumentTranslationEngine::setRefiner(LLMInterface *llm) {
+    llm_ = llm;
+}
+
+QList<DocumentSplitter::Segment> DocumentTranslationEngine::translate(const QList<DocumentSplitter::Segment> &segments) {
+    int next = 0;
+    qint64 words = 0;
+    for (const auto &segment : segments)
+        words += segment.words;
+
+    QList<DocumentSplitter::Segment> translated;
+    bool ok = translate([&](DocumentSplitter::Segment &segment) {
+        if (next == segments.size())
+            return false;
+        segment = segments[next++];
+        return true;
+    }, [&](const DocumentSplitter::Segment &segment) {
+        translated.append(segment);
+        return true;
+    }, segments.size(), words);
+
+    if (!ok)
+        return {};
+
+    std::sort(translated.begin(), translated.end(), [](const DocumentSplitter::Segment &a, const DocumentSplitter::Segment &b) {
+        return a.index < b.index;
+    });
+    return translated;
+}
+
+bool DocumentTranslationEngine::translate(const SegmentSource &source, const SegmentSink &sink, int total, qint64 totalWords) {
+    source_ = source;
+    sink_ = sink;
+    total_ = total;
+    entries_.clear();
+    inFlight_.clear();
+    first_ = 0;
+    active_ = 0;
+    nextRefine_ = 0;
+    refineBatch_.clear();
+    refineFailed_ = false;
+    translated_ = 0;
+    exhausted_ = false;
+    failed_ = false;
+
+    QEventLoop loop;
+    loop_ = &loop;
+
+    QList<QMetaObject::Connection> connections;
+    connections << connect(translator_, &MarianInterface::batchTranslationReady,
+                           this, &DocumentTranslationEngine::onTranslationReady);
+    connections << connect(translator_, &MarianInterface::error,
+                           this, &DocumentTranslationEngine::onError);
+
+    if (llm_) {
+        connections << connect(llm_, &LLMInterface::verificationReady,
+                               this, &DocumentTranslationEngine::onRefinementReady);
+        connections << connect(llm_, &LLMInterface::verificationProgress,
+                               this, &DocumentTranslationEngine::onRefinementProgress);
+        connections << connect(llm_, &LLMInterface::error,
+                               this, &DocumentTranslationEngine::onRefinementError);
+    }
+
+    emit progress(0, total_);
+    meter_.start(totalWords);
+    lastWordReport_.invalidate();
+    reportWords(true);
+    fill();
+
+    if (!complete() && !failed_ && !cancelled_)
+        loop.exec();
+
+    for (auto &connection : connections)
+        disconnect(connection);
+    loop_ = nullptr;
+
+    if (failed_ || cancelled_) {
+        // Don't leave the rest of this document queued in the service
+        translator_->cancelBatch();
+        if (llm_ && refining())
+            llm_->cancelVerification();
+    }
+
+    bool ok = !failed_ && !cancelled_;
+    if (ok)
+        reportWords(true);
+    inFlight_.clear();
+    entries_.clear();
+    refineBatch_.clear();
+    source_ = nullptr;
+    sink_ = nullptr;
+    return ok;
+}
+
+void DocumentTranslationEngine::cancel() {
+    cancelled_ = true;
+    // Might be called from another thread, so let our own thread stop the loop
+    QMetaObject::invokeMethod(this, [this]() { finish(); }, Qt::QueuedConnection);
+}
+
+void DocumentTranslationEngine::fill() {
+    // active_ is the number of segments submitted but not finished yet,
+    // i.e. being translated, waiting for the LLM, or being refined. Finished
+    // segments wait in entries_ until all before them are finished too, so
+    // that is bounded as well.
+    while (!failed_ && !cancelled_ && !exhausted_ && active_ < window_ &&
+           entries_.size() < static_cast<size_t>(MAX_BUFFERED_WINDOWS * window_)) {
+        Entry entry;
+        if (!source_(entry.source)) {
+            exhausted_ = true;
+            break;
+        }
+        entry.result = entry.source;
+        entry.stage = Translating;
+        entry.partsLeft = 0;
+        entry.confidence.resize(entry.source.paragraphs.size());
+        entries_.push_back(std::move(entry));
+        active_++;
+
+        int pos = first_ + static_cast<int>(entries_.size()) - 1;
+
+        // Paragraphs are translated as separate requests (which the service
+        // batches together anyway), so each translation goes back to its own
+        // paragraph. Empty ones are kept as-is.
+        const DocumentSplitter::Segment &segment = entries_.back().source;
+        for (int part = 0; part < segment.paragraphs.size(); ++part) {
+            if (segment.paragraphs[part].text.trimmed().isEmpty())
+                continue;
+            entries_.back().partsLeft++;
+            if (!submit(segment.paragraphs[part].text, segment.html, pos, part))
+                return;
+        }
+        if (entries_.back().partsLeft == 0)
+            onSegmentTranslated(pos);
+    }
+
+    refineNext();
+
+    // Hand finished segments over in order
+    while (!failed_ && !cancelled_ && !entries_.empty() && entries_.front().stage == Done) {
+        if (!sink_(entries_.front().result)) {
+            failed_ = true;
+            finish();
+            return;
+        }
+        entries_.pop_front();
+        first_++;
+    }
+
+    if (complete())
+        finish();
+}
+
+bool DocumentTranslationEngine::submit(const QString &text, bool html, int pos, int part) {
+    // Sentence confidences only matter to a refiner that picks sentences
+    MarianInterface::BatchExtras extras = MarianInterface::NoExtras;
+    if (llm_ && llm_->usesConfidence())
+        extras |= MarianInterface::QualityScores;
+
+    int id = translator_->enqueue(text, html, extras);
+    if (id < 0) {
+        onError(tr("No translation model loaded"));
+        return false;
+    }
+    inFlight_.insert(id, {pos, part});
+    return true;
+}
+
+void DocumentTranslationEngine::refineNext() {
+    if (!llm_ || failed_ || cancelled_ || refining())
+        return;
+
+    // Segments are refined in document order. Those that are translated go
+    // to the LLM together, their lines one after the other, so it can send
+    // chunks of several of them at once.
+    QString source;
+    QString translation;
+    QVector<QVector<float>> confidence;
+    while (refineBatch_.size() < MAX_REFINE_BATCH && nextRefine_ < first_ + static_cast<int>(entries_.size()) &&
+           entry(nextRefine_).stage == Translated) {
+        int pos = nextRefine_++;
+        Entry &next = entry(pos);
+
+        QString segmentSource = next.source.text();
+        QString segmentTranslation = next.result.text();
+        if (segmentSource.trimmed().isEmpty() || segmentTranslation.trimmed().isEmpty()) {
+            markDone(pos);
+            continue;
+        }
+
+        if (!refineBatch_.isEmpty()) {
+            source += '\n';
+            translation += '\n';
+        }
+        source += segmentSource;
+        translation += segmentTranslation;
+        confidence += next.confidence;
+        next.stage = Refining;
+        refineBatch_.append(pos);
+    }
+
+    if (refineBatch_.isEmpty())
+        return;
+
+    refineFailed_ = false;
+    emit refinementProgress(refineBatch_.last() + 1, total_, 0, 0);
+    llm_->verifyTranslation(source, translation, confidence);
+}
+
+DocumentTranslationEngine::Entry &DocumentTranslationEngine::entry(int pos) {
+    return entries_[pos - first_];
+}
+
+bool DocumentTranslationEngine::refining() const {
+    return !refineBatch_.isEmpty();
+}
+
+bool DocumentTranslationEngine::complete() const {
+    return exhausted_ && entries_.empty();
+}
+
+void DocumentTranslationEngine::markDone(int pos) {
+    entry(pos).stage = Done;
+    active_--;
+}
+
+void DocumentTranslationEngine::finish() {
+    if (loop_)
+        loop_->quit();
+}
+
+void DocumentTranslationEngine::onTranslationReady(int id, Translation translation) {
+    // Answers to requests we did not make (or gave up on) are ignored
+    auto it = inFlight_.find(id);
+    if (it == inFlight_.end())
+        return;
+
+    int pos = it.value().first;
+    int part = it.value().second;
+    inFlight_.erase(it);
+
+    // Whitespace in HTML is collapsed anyway
+    Entry &translatedEntry = entry(pos);
+    QString text = translation.translation();
+    translatedEntry.result.paragraphs[part].text = translatedEntry.result.html ? text.simplified() : text;
+    translatedEntry.confidence[part] = translation.sentenceConfidences();
+    meter_.add(DocumentSplitter::countWords(translatedEntry.source.paragraphs[part].text));
+    reportWords(false);
+    if (--translatedEntry.partsLeft == 0)
+        onSegmentTranslated(pos);
+
+    fill();
+}
+
+void DocumentTranslationEngine::reportWords(bool force) {
+    if (!force && lastWordReport_.isValid() && lastWordReport_.elapsed() < WORD_PROGRESS_INTERVAL_MS)
+        return;
+
+    lastWordReport_.start();
+    emit wordProgress(meter_.done(), meter_.total(), meter_.wordsPerSecond(), meter_.etaSeconds());
+}
+
+void DocumentTranslationEngine::onSegmentTranslated(int pos) {
+    entry(pos).stage = Translated;
+    translated_++;
+    emit progress(translated_, total_);
+
+    if (!llm_)
+        markDone(pos);
+}
+
+void DocumentTranslationEngine::onError(QString message) {
+    qWarning() << "DocumentTranslationEngine:" << message;
+    failed_ = true;
+    emit error(message);
+    finish();
+}
+
+void DocumentTranslationEngine::onRefinementReady(QString suggestion) {
+    if (!refining())
+        return;
+
+    // The LLM sees the paragraphs of the batch one per line. Its answer can
+    // only be taken if it kept them that way.
+    int expected = 0;
+    for (int pos : refineBatch_)
+        expected += entry(pos).result.paragraphs.size();
+    QStringList lines = suggestion.isEmpty() ? QStringList() : suggestion.split('\n');
+    bool usable = lines.size() == expected;
+    if (!suggestion.isEmpty() && !usable) {
+        qWarning() << "Refinement of segments" << entry(refineBatch_.first()).result.identifier << "to"
+                   << entry(refineBatch_.last()).result.identifier << "has" << lines.size()
+                   << "lines instead of" << expected << "- keeping the machine translation";
+    }
+
+    int line = 0;
+    for (int pos : refineBatch_) {
+        if (usable) {
+            for (auto &paragraph : entry(pos).result.paragraphs)
+                paragraph.text = lines[line++];
+            // A chunk that failed kept its machine translation
+            entry(pos).result.refined = !refineFailed_;
+        }
+        markDone(pos);
+    }
+    refineBatch_.clear();
+    refineGeneration_++;
+
+    // We're called from inside LLMInterface; start on the next segments (and
+    // submit more for translation) once it has returned.
+    QMetaObject::invokeMethod(this, [this]() { fill(); }, Qt::QueuedConnection);
+}
+
+void DocumentTranslationEngine::onRefinementProgress(int completed, int total) {
+    if (refining())
+        emit refinementProgress(refineBatch_.last() + 1, total_, completed, total);
+}
+
+void DocumentTranslationEngine::onRefinementError(QString message) {
+    emit refinementError(message);
+    if (refining())
+        refineFailed_ = true;
+
+    // Some errors are followed by verificationReady() (the failed chunk keeps
+    // its machine translation), others end the verification on the spot. Give
+    // LLMInterface the chance to finish; if it did not, give up on these
+    // segments and keep their machine translation.
+    int generation = refineGeneration_;
+    QMetaObject::invokeMethod(this, [this, generation]() {
+        if (generation != refineGeneration_ || !refining())
+            return;
+
+        llm_->cancelVerification();
+        refineGeneration_++;
+        for (int pos : refineBatch_)
+            markDone(pos);
+        refineBatch_.clear();
+        fill();
+    }, Qt::QueuedConnection);
+}
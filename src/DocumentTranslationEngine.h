@@ -0,0 +1,162 @@
+#ifndef DOCUMENTTRANSLATIONENGINE_H
+#define DOCUMENTTRANSLATIONENGINE_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QVector>
+#include <QPair>
+#include <QStringList>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include "DocumentSplitter.h"
+#include "Translation.h"
+#include "ProgressMeter.h"
+
+class MarianInterface;
+class LLMInterface;
+class QEventLoop;
+
+/**
+ * Translates all segments of a document through MarianInterface::enqueue(),
+ * keeping up to window() segments in flight at the same time so the
+ * translation service can batch across them and use all its worker threads.
+ * Each paragraph is a request of its own. Results arrive in any order and are
+ * put back in their paragraph and segment. Segments holding HTML
+ * (Segment::html) are translated in the service's HTML mode.
+ *
+ * When a refiner is set, segments go through a second stage: they are handed
+ * to LLMInterface::verifyTranslation() in document order as soon as their
+ * machine translation is in, while the following segments are still being
+ * machine translated. The segments translated by then (up to
+ * MAX_REFINE_BATCH) go together as one text, so the LLM can work on chunks of
+ * several segments at the same time. window() bounds all segments that have been submitted
+ * but are not yet refined, so machine translation can run at most that far
+ * ahead of the LLM. Segments whose refinement failed, or was not usable,
+ * keep their machine translation and have Segment::refined unset.
+ *
+ * Progress is reported in segments, and in words (Segment::words) with the
+ * speed and time left.
+ *
+ * Segments can also be streamed: they are taken from a source as there is
+ * room in the window, and handed to a sink in order as soon as they and all
+ * segments before them are done. Only those in between are kept, so memory
+ * does not depend on the size of the document.
+ */
+class DocumentTranslationEngine : public QObject {
+    Q_OBJECT
+public:
+    explicit DocumentTranslationEngine(MarianInterface *translator, QObject *parent = nullptr);
+
+    // Default number of segments submitted to the service at any time.
+    static constexpr int DEFAULT_WINDOW = 16;
+
+    void setWindow(int segments);
+    int window() const;
+
+    // Refine machine translations with `llm`. nullptr (default) disables it.
+    void setRefiner(LLMInterface *llm);
+
+    // Fills in the next segment and returns true, or returns false if there
+    // are no more.
+    using SegmentSource = std::function<bool(DocumentSplitter::Segment &)>;
+    // Takes a translated segment. Returning false stops the translation.
+    using SegmentSink = std::function<bool(const DocumentSplitter::Segment &)>;
+
+    /**
+     * Translates `segments` and returns them, sorted by index, with the text
+     * of their paragraphs replaced by the translation. Blocks (running a
+     * local event loop) until all segments are done. Returns an empty list on
+     * error or cancel().
+     */
+    QList<DocumentSplitter::Segment> translate(const QList<DocumentSplitter::Segment> &segments);
+
+    /**
+     * Streaming version: translates the segments of `source`, in the order it
+     * gives them, and hands them to `sink` in that order. `total` and
+     * `totalWords` are the number of segments and words for progress(), or -1
+     * if not known. Blocks like the other translate(). Returns false on error
+     * or cancel().
+     */
+    bool translate(const SegmentSource &source, const SegmentSink &sink, int total = -1, qint64 totalWords = -1);
+
+    // Safe to call from any thread.
+    void cancel();
+
+signals:
+    void progress(int completed, int total); // total is -1 if not known
+    // Machine translated words. total and etaSeconds are -1 if not known.
+    void wordProgress(qint64 completed, qint64 total, double wordsPerSecond, qint64 etaSeconds);
+    void refinementProgress(int segment, int total, int completedChunks, int totalChunks);
+    void refinementError(QString message); // Not fatal, segment keeps its machine translation
+    void error(QString message);
+
+private slots:
+    void onTranslationReady(int id, Translation translation);
+    void onError(QString message);
+    void onRefinementReady(QString suggestion);
+    void onRefinementProgress(int completed, int total);
+    void onRefinementError(QString message);
+
+private:
+    enum Stage {
+        Translating,
+        Translated,
+        Refining,
+        Done
+    };
+
+    struct Entry {
+        DocumentSplitter::Segment source;
+        DocumentSplitter::Segment result;
+        Stage stage;
+        int partsLeft; // Paragraphs still being translated
+        QVector<QVector<float>> confidence; // Per paragraph, of each sentence of its translation
+    };
+
+    // Finished segments (per window) that may wait for an earlier one
+    static constexpr int MAX_BUFFERED_WINDOWS = 4;
+
+    // Segments refined together in one verifyTranslation()
+    static constexpr int MAX_REFINE_BATCH = 4;
+
+    // At most one wordProgress() per this many ms: paragraphs come in fast
+    static constexpr qint64 WORD_PROGRESS_INTERVAL_MS = 250;
+
+    void fill();
+    bool submit(const QString &text, bool html, int pos, int part);
+    void onSegmentTranslated(int pos);
+    void refineNext();
+    Entry &entry(int pos);
+    bool refining() const;
+    bool complete() const;
+    void markDone(int pos);
+    void finish();
+    void reportWords(bool force);
+
+    MarianInterface *translator_;
+    LLMInterface *llm_;
+    int window_;
+
+    SegmentSource source_;
+    SegmentSink sink_;
+    int total_;
+    std::deque<Entry> entries_;            // Segments taken from source_ but not handed to sink_
+    QHash<int, QPair<int, int>> inFlight_; // MarianInterface id -> position, paragraph
+    int first_;      // Position (in the order of source_) of entries_.front()
+    int active_;     // Entries that are not Done
+    int nextRefine_; // Next segment (in order) to hand to the LLM
+    QVector<int> refineBatch_; // Segments being refined, in order
+    bool refineFailed_; // The LLM reported an error while refining refineBatch_
+    int translated_;
+    ProgressMeter meter_;
+    QElapsedTimer lastWordReport_;
+    int refineGeneration_;
+    bool exhausted_; // source_ has no more segments
+    bool failed_;
+    std::atomic<bool> cancelled_;
+    QEventLoop *loop_;
+};
+
+#endif // DOCUMENTTRANSLATIONENGINE_H
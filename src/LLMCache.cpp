@@ -0,0 +1,130 @@
+#include "LLMCache.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+
+namespace {
+// Keys are SHA-256 in hex
+constexpr int kKeyLength = 64;
+}
+
+LLMCache::LLMCache(const QString &directory)
+    : directory_(directory), maxBytes_(DEFAULT_MAX_BYTES), ttlSeconds_(DEFAULT_TTL_SECONDS),
+      scanned_(false), totalBytes_(0) {
+}
+
+QString LLMCache::defaultDirectory() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/llm";
+}
+
+void LLMCache::setLimits(qint64 maxBytes, qint64 ttlSeconds) {
+    maxBytes_ = maxBytes;
+    ttlSeconds_ = ttlSeconds;
+}
+
+QByteArray LLMCache::key(const QString &provider, const QString &model, const QString &promptTemplate,
+                         const QString &source, const QString &machineTranslation) {
+    // Every field with its length in front, so different requests never
+    // hash the same bytes
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    for (const QString *field : {&provider, &model, &promptTemplate, &source, &machineTranslation}) {
+        QByteArray utf8 = field->toUtf8();
+        hash.addData(QByteArray::number(utf8.size()) + ':');
+        hash.addData(utf8);
+    }
+    return hash.result().toHex();
+}
+
+QString LLMCache::pathOf(const QString &key) const {
+    // A level of directories by the first two digits, so no directory
+    // holds more than a few thousand answers
+    return QString("%1/%2/%3").arg(directory_, key.left(2), key);
+}
+
+bool LLMCache::lookup(const QByteArray &key, QString &text) {
+    QString name = QString::fromLatin1(key);
+    QFile file(pathOf(name));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 written = QFileInfo(file).lastModified().toMSecsSinceEpoch();
+    if (ttlSeconds_ > 0 && QDateTime::currentMSecsSinceEpoch() - written > ttlSeconds_ * 1000) {
+        file.close();
+        remove(name);
+        return false;
+    }
+
+    text = QString::fromUtf8(file.readAll());
+    return true;
+}
+
+void LLMCache::insert(const QByteArray &key, const QString &text) {
+    QString name = QString::fromLatin1(key);
+    QString path = pathOf(name);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QByteArray data = text.toUtf8();
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) < 0 || !file.commit()) {
+        qWarning() << "LLMCache: Could not write" << path << ":" << file.errorString();
+        return;
+    }
+
+    if (!scanned_)
+        scan(); // Finds the new answer too
+    else
+        record(name, {data.size(), QDateTime::currentMSecsSinceEpoch()});
+    prune();
+}
+
+void LLMCache::scan() {
+    scanned_ = true;
+    QDirIterator it(directory_, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        QFileInfo info = it.fileInfo();
+        if (info.fileName().size() != kKeyLength)
+            continue; // Not ours, or being written
+        record(info.fileName(), {info.size(), info.lastModified().toMSecsSinceEpoch()});
+    }
+}
+
+void LLMCache::record(const QString &key, const Entry &entry) {
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        totalBytes_ -= it->bytes;
+        byAge_.remove(it->written, key);
+    }
+    entries_.insert(key, entry);
+    byAge_.insert(entry.written, key);
+    totalBytes_ += entry.bytes;
+}
+
+void LLMCache::remove(const QString &key) {
+    QFile::remove(pathOf(key));
+
+    auto it = entries_.find(key);
+    if (it == entries_.end())
+        return;
+    totalBytes_ -= it->bytes;
+    byAge_.remove(it->written, key);
+    entries_.erase(it);
+}
+
+void LLMCache::prune() {
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    while (!byAge_.isEmpty()) {
+        auto oldest = byAge_.begin();
+        bool expired = ttlSeconds_ > 0 && now - oldest.key() > ttlSeconds_ * 1000;
+        if (!expired && (maxBytes_ <= 0 || totalBytes_ <= maxBytes_))
+            break;
+        QString key = oldest.value(); // remove() erases the node holding it
+        remove(key);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef LLMCACHE_H
+#define LLMCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMultiMap>
+#include <QString>
+
+/**
+ * Answers of the LLM, kept on disk so that translating a document again (or
+ * the same text in another document) doesn't pay for the same request twice.
+ * An answer is only reused for exactly the same request: the key hashes the
+ * provider, the model, the prompt template and the source and machine
+ * translation of the chunk.
+ *
+ * Every answer is a file in the cache directory, named by its key, so a
+ * crash never damages more than the answer being written. Answers older
+ * than the time to live are not used; when the files add up to more than
+ * the size limit, the oldest are removed.
+ */
+class LLMCache {
+public:
+    static constexpr qint64 DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+    static constexpr qint64 DEFAULT_TTL_SECONDS = 30 * 24 * 3600;
+
+    explicit LLMCache(const QString &directory = defaultDirectory());
+
+    static QString defaultDirectory();
+
+    // 0 for no limit
+    void setLimits(qint64 maxBytes, qint64 ttlSeconds);
+
+    static QByteArray key(const QString &provider, const QString &model, const QString &promptTemplate,
+                          const QString &source, const QString &machineTranslation);
+
+    // True, with the answer in `text`, if there is a live one for `key`
+    bool lookup(const QByteArray &key, QString &text);
+    void insert(const QByteArray &key, const QString &text);
+
+private:
+    struct Entry {
+        qint64 bytes;
+        qint64 written; // ms since epoch
+    };
+
+    QString pathOf(const QString &key) const;
+    void scan();
+    void record(const QString &key, const Entry &entry);
+    void remove(const QString &key);
+    void prune();
+
+    QString directory_;
+    qint64 maxBytes_;
+    qint64 ttlSeconds_;
+
+    // What insert() needs to keep the size limit, read from the directory the first time
+    bool scanned_;
+    qint64 totalBytes_;
+    QHash<QString, Entry> entries_;
+    QMultiMap<qint64, QString> byAge_; // Written -> key, oldest first
+};
+
+#endif // LLMCACHE_H
@@ -1,109 +1,250 @@
 #include "LLMInterface.h"
+#include "RefinementSelector.h"
 #include <QUrl>
 #include <QNetworkRequest>
 #include <QRegularExpression>
+#include <QTimer>
 #include <QDebug>
 
+namespace {
+
+// The server is overloaded or rate limiting: worth trying again, with fewer
+// requests in flight. Our own aborts never get here (cancelVerification()
+// disconnects first), so a cancelled reply is one that hit its timeout.
+bool pushedBack(QNetworkReply *reply) {
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return status == 429 || status >= 500
+        || reply->error() == QNetworkReply::OperationCanceledError
+        || reply->error() == QNetworkReply::TimeoutError;
+}
+
+// The text without <think> sections (an unterminated one runs to the end),
+// for reasoning models that think out loud despite the prompt
+QString withoutThinking(QString text) {
+    int thinkStart = text.indexOf("<think>");
+    while (thinkStart != -1) {
+        int thinkEnd = text.indexOf("</think>", thinkStart);
+        if (thinkEnd != -1) {
+            text.remove(thinkStart, (thinkEnd + 8) - thinkStart);
+        } else {
+            text.remove(thinkStart, text.length() - thinkStart);
+        }
+        thinkStart = text.indexOf("<think>");
+    }
+    return text;
+}
+
+// Ultra-short prompt to fit in 4k context window models
+// Format: ~20 tokens for instructions, leaving ~3800 tokens for text + response
+const char *PROMPT_TEMPLATE = "Improve this French translation. Output ONLY the improved French, no explanations.\n\n"
+                              "Source: %1\n\n"
+                              "Translation: %2\n\n"
+                              "Improved:";
+
+// "error" of an API response: a message, or an object with one
+QString errorMessage(const QJsonValue &error) {
+    return error.isString() ? error.toString() : error.toObject()["message"].toString();
+}
+
+} // namespace
+
 LLMInterface::LLMInterface(Settings *settings, QObject *parent)
     : QObject(parent), settings_(settings), networkManager_(new QNetworkAccessManager(this)) {
 }
 
-void LLMInterface::verifyTranslation(const QString &sourceText, const QString &translatedText) {
+void LLMInterface::verifyTranslation(const QString &sourceText, const QString &translatedText,
+                                     const QVector<QVector<float>> &confidence) {
     qDebug() << "LLMInterface: Starting verification. Enabled:" << settings_->llmEnabled();
     if (!settings_->llmEnabled() || sourceText.trimmed().isEmpty()) return;
 
-    // Abort active requests
-    for (auto* reply : activeRequests_.keys()) {
-        reply->abort();
-        reply->deleteLater();
-    }
-    activeRequests_.clear();
+    abortRequests();
     chunks_.clear();
     completedCount_ = 0;
+    concurrency_.setMaximum(maxConcurrent());
+
+    selectUnits(sourceText, translatedText, confidence);
+
+    // Chunks of units, one per line, keeping source and translation
+    // synchronized by line. A unit longer than a chunk gets one of its own.
+    for (int u = 0; u < units_.size(); ++u) {
+        const Unit &unit = units_[u];
+        if (chunks_.isEmpty() || chunks_.last().source.length() + unit.source.length() + 1 > CHUNK_SIZE ||
+            chunks_.last().machineTranslation.length() + unit.translation.length() + 1 > CHUNK_SIZE) {
+            Chunk c;
+            c.index = chunks_.size();
+            c.firstUnit = u;
+            chunks_.append(c);
+        }
 
-    // Split text into chunks, keeping source and translation synchronized by line
-    const int CHUNK_SIZE = 2000;  // ~600-700 tokens, safe for 32k context models
+        Chunk &chunk = chunks_.last();
+        if (chunk.unitCount++ > 0) {
+            chunk.source += '\n';
+            chunk.machineTranslation += '\n';
+        }
+        chunk.source += unit.source;
+        chunk.machineTranslation += unit.translation;
+        chunk.refinedTranslation = chunk.machineTranslation;
+    }
 
-    QStringList sourceLines = sourceText.split('\n');
-    QStringList transLines = translatedText.split('\n');
-    int maxLines = qMax(sourceLines.size(), transLines.size());
+    qDebug() << "LLMInterface: Created" << chunks_.size() << "chunks.";
 
-    QString currentSource;
-    QString currentTrans;
+    // Chunks refined before with the same provider, model and prompt come
+    // from the cache; the rest wait for a request
+    bool useCache = settings_->llmCache();
+    if (useCache) {
+        cache_.setLimits(static_cast<qint64>(settings_->llmCacheMegabytes()) * 1024 * 1024,
+                         static_cast<qint64>(settings_->llmCacheDays()) * 24 * 3600);
+    }
+    offsets_.reset(chunks_.size());
+    for (auto& chunk : chunks_) {
+        if (useCache) {
+            chunk.cacheKey = LLMCache::key(settings_->llmProvider(), settings_->llmModel(), PROMPT_TEMPLATE,
+                                           chunk.source, chunk.machineTranslation);
+            if (cache_.lookup(chunk.cacheKey, chunk.refinedTranslation)) {
+                chunk.completed = true;
+                completedCount_++;
+                cachedChunks_++;
+            }
+        }
+        if (!chunk.completed)
+            ready_.enqueue(chunk.index);
+        offsets_.setLength(chunk.index, chunk.refinedTranslation.size() + (chunk.index > 0 ? 2 : 0));
+    }
+    qDebug() << "LLMInterface:" << completedCount_ << "of" << chunks_.size() << "chunks from the cache.";
 
-    for (int i = 0; i < maxLines; ++i) {
-        QString sourceLine = (i < sourceLines.size()) ? sourceLines[i] + "\n" : "";
-        QString transLine = (i < transLines.size()) ? transLines[i] + "\n" : "";
+    emit verificationStarted();
+    emit verificationProgress(completedCount_, chunks_.size());
 
-        // If adding this line would exceed chunk size, create a chunk first
-        if (!currentSource.isEmpty() &&
-            (currentSource.length() + sourceLine.length() > CHUNK_SIZE ||
-             currentTrans.length() + transLine.length() > CHUNK_SIZE)) {
-            Chunk c = {static_cast<int>(chunks_.size()), currentSource.trimmed(),
-                      currentTrans.trimmed(), currentTrans.trimmed(), false};
-            chunks_.append(c);
-            currentSource.clear();
-            currentTrans.clear();
-        }
+    if (completedCount_ == chunks_.size()) {
+        // Nothing to ask (all chunks cached, or no sentence selected). Answer
+        // from the event loop, as when the answers come from the network.
+        int generation = generation_;
+        QMetaObject::invokeMethod(this, [this, generation]() {
+            if (generation == generation_)
+                emit verificationReady(refinedText());
+        }, Qt::QueuedConnection);
+        return;
+    }
+    processQueue();
+}
 
-        // If a SINGLE line is too long, split it proportionally to maintain alignment
-        if (sourceLine.length() > CHUNK_SIZE || transLine.length() > CHUNK_SIZE) {
-            int maxLen = qMax(sourceLine.length(), transLine.length());
-            int numSplits = (maxLen + CHUNK_SIZE - 1) / CHUNK_SIZE;
+int LLMInterface::cachedChunks() const {
+    return cachedChunks_;
+}
+
+int LLMInterface::refinedChunks() const {
+    return refinedChunks_;
+}
+
+int LLMInterface::skippedSentences() const {
+    return skippedSentences_;
+}
 
-            for (int split = 0; split < numSplits; ++split) {
-                int sourceChunkLen = sourceLine.length() / numSplits;
-                int transChunkLen = transLine.length() / numSplits;
+bool LLMInterface::usesConfidence() const {
+    return settings_->llmRefineThreshold() > 0;
+}
 
-                currentSource = sourceLine.mid(split * sourceChunkLen, sourceChunkLen);
-                currentTrans = transLine.mid(split * transChunkLen, transChunkLen);
+void LLMInterface::selectUnits(const QString &sourceText, const QString &translatedText,
+                               const QVector<QVector<float>> &confidence) {
+    // A unit is a whole line (paragraph) when every sentence is refined and
+    // it fits in a chunk, otherwise each of its sentences is one. Below the
+    // threshold score only the sentences that look wrong are.
+    const double threshold = settings_->llmRefineThreshold() / 100.0;
+    const QStringList sourceLines = sourceText.split('\n');
+    lines_ = translatedText.split('\n');
+    units_.clear();
+
+    for (int line = 0; line < lines_.size(); ++line) {
+        const QString source = line < sourceLines.size() ? sourceLines[line] : QString();
+        const QString &translation = lines_[line];
+        if (source.trimmed().isEmpty() || translation.trimmed().isEmpty())
+            continue;
+
+        QVector<RefinementSelector::Range> sourceSentences;
+        QVector<RefinementSelector::Range> sentences;
+        if (threshold > 0 || source.length() > CHUNK_SIZE || translation.length() > CHUNK_SIZE) {
+            sourceSentences = RefinementSelector::sentences(source);
+            sentences = RefinementSelector::sentences(translation);
+        }
+        if (sentences.isEmpty() || sentences.size() != sourceSentences.size()) {
+            // Not split, or the sentences don't pair up: the line is one unit
+            sourceSentences = {RefinementSelector::trimmed(source, 0, source.length())};
+            sentences = {RefinementSelector::trimmed(translation, 0, translation.length())};
+        }
 
-                if (!currentSource.trimmed().isEmpty()) {
-                    Chunk c = {static_cast<int>(chunks_.size()), currentSource.trimmed(),
-                              currentTrans.trimmed(), currentTrans.trimmed(), false};
-                    chunks_.append(c);
+        // The service scores the sentences it translated; if it split the
+        // line differently, the worst of them stands for all
+        const QVector<float> lineConfidence = line < confidence.size() ? confidence[line] : QVector<float>();
+        double worst = -1;
+        for (float score : lineConfidence)
+            worst = worst < 0 ? score : qMin(worst, static_cast<double>(score));
+
+        for (int i = 0; i < sentences.size(); ++i) {
+            Unit unit;
+            unit.line = line;
+            unit.begin = sentences[i].begin;
+            unit.end = sentences[i].end;
+            unit.source = source.mid(sourceSentences[i].begin, sourceSentences[i].end - sourceSentences[i].begin);
+            unit.translation = translation.mid(unit.begin, unit.end - unit.begin);
+
+            if (threshold > 0) {
+                double modelConfidence = lineConfidence.size() == sentences.size() ? lineConfidence[i] : worst;
+                if (RefinementSelector::score(unit.source, unit.translation, modelConfidence) >= threshold) {
+                    skippedSentences_++;
+                    continue;
                 }
             }
-            currentSource.clear();
-            currentTrans.clear();
-        } else {
-            currentSource += sourceLine;
-            currentTrans += transLine;
+            units_.append(unit);
         }
     }
+    qDebug() << "LLMInterface:" << units_.size() << "units to refine," << skippedSentences_ << "sentences skipped so far.";
+}
 
-    // Final chunk if any text remains
-    if (!currentSource.trimmed().isEmpty()) {
-        Chunk c = {static_cast<int>(chunks_.size()), currentSource.trimmed(),
-                  currentTrans.trimmed(), currentTrans.trimmed(), false};
-        chunks_.append(c);
+QString LLMInterface::refinedText() const {
+    // Every answer line goes back in place of its unit. Units are in text
+    // order, so replacing from the last one keeps the others' ranges valid.
+    QStringList lines = lines_;
+    for (int c = chunks_.size() - 1; c >= 0; --c) {
+        const Chunk &chunk = chunks_[c];
+        QStringList answers = chunk.refinedTranslation.split('\n', Qt::SkipEmptyParts);
+        if (answers.size() != chunk.unitCount) {
+            qWarning() << "LLMInterface: Chunk" << c << "has" << answers.size() << "lines instead of"
+                       << chunk.unitCount << "- keeping the machine translation";
+            continue;
+        }
+        for (int k = chunk.unitCount - 1; k >= 0; --k) {
+            const Unit &unit = units_[chunk.firstUnit + k];
+            QString answer = answers[k].trimmed();
+            if (!answer.isEmpty())
+                lines[unit.line].replace(unit.begin, unit.end - unit.begin, answer);
+        }
     }
+    return lines.join('\n');
+}
 
-    qDebug() << "LLMInterface: Created" << chunks_.size() << "chunks.";
-    if (chunks_.isEmpty()) return;
+int LLMInterface::maxConcurrent() const {
+    unsigned int configured = settings_->llmMaxConcurrent();
+    if (configured > 0)
+        return static_cast<int>(configured);
 
-    emit verificationStarted();
-    emit verificationProgress(0, chunks_.size());
-    processQueue();
+    // A local server usually runs one generation at a time; cloud APIs take
+    // several, and the controller backs off if that is too many.
+    QString provider = settings_->llmProvider();
+    return (provider == "Ollama" || provider == "LM Studio") ? 1 : 4;
 }
 
 void LLMInterface::processQueue() {
-    int maxConcurrent = 1; // Strict sequencing for local LLM stability
-    if (activeRequests_.size() >= maxConcurrent) return;
-
-    for (int i = 0; i < chunks_.size(); ++i) {
-        if (!chunks_[i].completed) {
-            bool isRunning = false;
-            auto it = activeRequests_.begin();
-            while (it != activeRequests_.end()) {
-                if (it.value() == i) { isRunning = true; break; }
-                ++it;
-            }
-            if (!isRunning) {
-                qDebug() << "LLMInterface: Sending chunk" << i;
-                sendRequest(i);
-                if (activeRequests_.size() >= maxConcurrent) break;
-            }
+    while (!ready_.isEmpty() && activeRequests_.size() < concurrency_.limit()) {
+        int index = ready_.dequeue();
+        qDebug() << "LLMInterface: Sending chunk" << index << "(" << activeRequests_.size() + 1
+                 << "of at most" << concurrency_.limit() << "in flight)";
+
+        int active = activeRequests_.size();
+        sendRequest(index);
+        if (activeRequests_.size() == active) {
+            // Not sent (e.g. no API key, already reported): the rest won't be either
+            ready_.clear();
+            return;
         }
     }
 }
@@ -111,13 +252,7 @@ void LLMInterface::processQueue() {
 void LLMInterface::sendRequest(int index) {
     QString provider = settings_->llmProvider();
 
-    // Ultra-short prompt to fit in 4k context window models
-    // Format: ~20 tokens for instructions, leaving ~3800 tokens for text + response
-    QString prompt = QString("Improve this French translation. Output ONLY the improved French, no explanations.\n\n"
-                             "Source: %1\n\n"
-                             "Translation: %2\n\n"
-                             "Improved:")
-                             .arg(chunks_[index].source, chunks_[index].machineTranslation);
+    QString prompt = QString(PROMPT_TEMPLATE).arg(chunks_[index].source, chunks_[index].machineTranslation);
 
     if (provider == "Ollama") {
         callOllama(index, prompt);
@@ -144,16 +279,14 @@ void LLMInterface::callOllama(int index, const QString &prompt) {
 
     QNetworkRequest request(url);
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    request.setTransferTimeout(30000); // Forcer l'attente infinie pour les modèles lents
+    request.setTransferTimeout(IDLE_TIMEOUT_MS);
 
     QJsonObject json;
     json["model"] = settings_->llmModel();
     json["prompt"] = prompt;
-    json["stream"] = false;
+    json["stream"] = true;  // One JSON object per line as tokens come in
 
-    QNetworkReply *reply = networkManager_->post(request, QJsonDocument(json).toJson());
-    activeRequests_.insert(reply, index);
-    connect(reply, &QNetworkReply::finished, this, [this, reply]() { handleReply(reply); });
+    post(index, request, QJsonDocument(json).toJson());
 }
 
 void LLMInterface::callLMStudio(int index, const QString &prompt) {
@@ -169,7 +302,7 @@ void LLMInterface::callLMStudio(int index, const QString &prompt) {
 
     QNetworkRequest request(url);
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    request.setTransferTimeout(30000); // Forcer l'attente infinie pour les modèles lents
+    request.setTransferTimeout(IDLE_TIMEOUT_MS);
 
     QJsonObject message;
     message["role"] = "user";
@@ -182,121 +315,253 @@ void LLMInterface::callLMStudio(int index, const QString &prompt) {
     json["model"] = settings_->llmModel().isEmpty() ? "default" : settings_->llmModel();
     json["messages"] = messages;
     json["temperature"] = 0.3;
-    json["stream"] = false;  // LM Studio requires explicit stream parameter
+    json["stream"] = true;  // Server-sent events as tokens come in
 
     QByteArray jsonData = QJsonDocument(json).toJson();
     qDebug() << "LLMInterface: Request JSON:" << jsonData;
 
-    QNetworkReply *reply = networkManager_->post(request, jsonData);
-    activeRequests_.insert(reply, index);
+    post(index, request, jsonData);
+}
+
+void LLMInterface::post(int index, const QNetworkRequest &request, const QByteArray &data) {
+    QNetworkReply *reply = networkManager_->post(request, data);
+    Request pending;
+    pending.chunkIndex = index;
+    pending.ticket = concurrency_.started();
+    activeRequests_.insert(reply, pending);
+    connect(reply, &QNetworkReply::readyRead, this, [this, reply]() { handleReadyRead(reply); });
     connect(reply, &QNetworkReply::finished, this, [this, reply]() { handleReply(reply); });
 }
 
+bool LLMInterface::retry(QNetworkReply *reply, int index) {
+    Chunk &chunk = chunks_[index];
+    if (++chunk.attempts >= MAX_ATTEMPTS)
+        return false;
+
+    // Wait as long as the server asks, or back off exponentially
+    int delay = qMin(reply->rawHeader("Retry-After").toInt(), MAX_RETRY_DELAY_MS / 1000) * 1000;
+    if (delay <= 0)
+        delay = qMin(RETRY_DELAY_MS << (chunk.attempts - 1), MAX_RETRY_DELAY_MS);
+
+    qWarning() << "LLMInterface: Chunk" << index << "pushed back, retrying in" << delay << "ms with at most"
+               << concurrency_.limit() << "requests in flight";
+
+    int generation = generation_;
+    QTimer::singleShot(delay, this, [this, index, generation]() {
+        if (generation != generation_)
+            return;
+        ready_.prepend(index);
+        processQueue();
+    });
+    return true;
+}
+
+void LLMInterface::handleReadyRead(QNetworkReply *reply) {
+    auto it = activeRequests_.find(reply);
+    if (it == activeRequests_.end())
+        return;
+
+    // An error body is read as a whole in handleReply()
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() >= 400)
+        return;
+
+    Request &request = it.value();
+    QByteArray data = reply->readAll();
+    request.body += data;
+    request.pending += data;
+    if (!readStream(request, false))
+        return;
+
+    chunks_[request.chunkIndex].partial = withoutThinking(request.text).trimmed();
+    showChunk(request.chunkIndex);
+}
+
+bool LLMInterface::readStream(Request &request, bool finished) {
+    // Ollama sends one JSON object per line, the others server-sent events
+    // ("data: {...}" lines, with "event:" lines and comments in between).
+    // A line that isn't complete yet stays pending, unless the reply is.
+    bool received = false;
+    int start = 0;
+    while (start < request.pending.size()) {
+        int end = request.pending.indexOf('\n', start);
+        if (end < 0) {
+            if (!finished)
+                break;
+            end = request.pending.size();
+        }
+        QByteArray line = request.pending.mid(start, end - start).trimmed();
+        start = end + 1;
+
+        if (line.startsWith("data:"))
+            line = line.mid(5).trimmed();
+        if (!line.startsWith('{'))
+            continue;
+
+        QJsonDocument doc = QJsonDocument::fromJson(line);
+        if (!doc.isObject())
+            continue;
+        if (doc.object().contains("error")) {
+            request.error = errorMessage(doc.object()["error"]);
+            continue;
+        }
+
+        QString text = responseText(doc.object(), true);
+        if (!text.isEmpty()) {
+            request.text += text;
+            received = true;
+        }
+    }
+    request.pending.remove(0, qMin(start, static_cast<int>(request.pending.size())));
+    return received;
+}
+
+QString LLMInterface::responseText(const QJsonObject &response, bool streamed) const {
+    QString provider = settings_->llmProvider();
+    if (provider == "Ollama") {
+        // Streamed or not, the (rest of the) answer is in "response"
+        return response["response"].toString();
+    } else if (provider == "LM Studio" || provider == "OpenAI") {
+        // OpenAI-compatible format: choices[0].message.content, streamed as choices[0].delta.content
+        QJsonArray choices = response["choices"].toArray();
+        if (choices.isEmpty())
+            return QString();
+        return choices[0].toObject()[streamed ? "delta" : "message"].toObject()["content"].toString();
+    } else if (provider == "Claude") {
+        // Anthropic Claude API: content[0].text, streamed as content_block_delta events
+        if (streamed) {
+            if (response["type"].toString() != "content_block_delta")
+                return QString();
+            return response["delta"].toObject()["text"].toString();
+        }
+        QJsonArray content = response["content"].toArray();
+        return content.isEmpty() ? QString() : content[0].toObject()["text"].toString();
+    } else if (provider == "Google Gemini") {
+        // Gemini API: candidates[0].content.parts[].text, streamed or not
+        QJsonArray candidates = response["candidates"].toArray();
+        if (candidates.isEmpty())
+            return QString();
+        QString text;
+        for (const auto &part : candidates[0].toObject()["content"].toObject()["parts"].toArray())
+            text += part.toObject()["text"].toString();
+        return text;
+    }
+    return QString();
+}
+
+const QString &LLMInterface::chunkText(int index) const {
+    // What has arrived so far while a request is in flight, otherwise the
+    // refined translation (the machine translation until there is one)
+    const Chunk &chunk = chunks_[index];
+    return chunk.partial.isEmpty() ? chunk.refinedTranslation : chunk.partial;
+}
+
+QString LLMInterface::currentText() const {
+    QString text;
+    text.reserve(offsets_.offset(offsets_.size()));
+    for (int i = 0; i < chunks_.size(); ++i) {
+        if (i > 0)
+            text += "\n\n";
+        text += chunkText(i);
+    }
+    return text;
+}
+
+int LLMInterface::chunkOffset(int index) const {
+    return offsets_.offset(index) + (index > 0 ? 2 : 0);
+}
+
+void LLMInterface::showChunk(int index) {
+    const QString &text = chunkText(index);
+    int separator = index > 0 ? 2 : 0; // The blank line goes with the chunk after it
+    int replaced = offsets_.length(index) - separator;
+    offsets_.setLength(index, text.size() + separator);
+    emit partialResultReady(index, chunkOffset(index), replaced, text);
+}
+
 void LLMInterface::handleReply(QNetworkReply *reply) {
     if (!activeRequests_.contains(reply)) {
         reply->deleteLater();
         return;
     }
 
-    int index = activeRequests_.take(reply);
+    Request request = activeRequests_.take(reply);
+    int index = request.chunkIndex;
+    chunks_[index].partial.clear();
     QString result;
 
+    if (pushedBack(reply)) {
+        concurrency_.congestion(request.ticket);
+        if (retry(reply, index)) {
+            showChunk(index); // Back to the machine translation until the retry answers
+            reply->deleteLater();
+            processQueue();
+            return;
+        }
+    } else if (reply->error() == QNetworkReply::NoError) {
+        concurrency_.success();
+    }
+
     if (reply->error() == QNetworkReply::NoError) {
-        QByteArray response = reply->readAll();
+        QByteArray data = reply->readAll();
+        request.body += data;
+        request.pending += data;
+        readStream(request, true);
         qDebug() << "LLMInterface: Received response for chunk" << index;
-        QJsonDocument doc = QJsonDocument::fromJson(response);
-
-        if (!doc.isNull() && doc.isObject()) {
-            if (settings_->llmProvider() == "Ollama") {
-                result = doc.object()["response"].toString();
-            } else if (settings_->llmProvider() == "LM Studio" || settings_->llmProvider() == "OpenAI") {
-                // OpenAI-compatible format: choices[0].message.content
-                QJsonArray choices = doc.object()["choices"].toArray();
-                if (!choices.isEmpty()) {
-                    result = choices[0].toObject()["message"].toObject()["content"].toString();
-                } else {
-                    qWarning() << "LLMInterface: Empty choices in response";
-                }
-            } else if (settings_->llmProvider() == "Claude") {
-                // Anthropic Claude API: content[0].text
-                QJsonArray content = doc.object()["content"].toArray();
-                if (!content.isEmpty()) {
-                    result = content[0].toObject()["text"].toString();
-                } else {
-                    qWarning() << "LLMInterface: Empty content in Claude response";
-                }
-            } else if (settings_->llmProvider() == "Google Gemini") {
-                // Check for API error in response first
-                if (doc.object().contains("error")) {
-                    QJsonObject errorObj = doc.object()["error"].toObject();
-                    QString errorMsg = errorObj["message"].toString();
-                    int errorCode = errorObj["code"].toInt();
-                    qWarning() << "LLMInterface: Gemini API error:" << errorCode << errorMsg;
-                    emit error(tr("Gemini API error: %1").arg(errorMsg));
-                    // Stop further processing - clear pending requests
-                    reply->deleteLater();
-                    activeRequests_.clear();
-                    return;
-                }
 
-                // Gemini API: candidates[0].content.parts[0].text
-                QJsonArray candidates = doc.object()["candidates"].toArray();
-                if (!candidates.isEmpty()) {
-                    QJsonObject contentObj = candidates[0].toObject()["content"].toObject();
-                    QJsonArray parts = contentObj["parts"].toArray();
-                    if (!parts.isEmpty()) {
-                        result = parts[0].toObject()["text"].toString();
-                    }
+        if (request.text.isEmpty() && request.error.isEmpty()) {
+            // Not streamed after all (the server ignored "stream"): one JSON object
+            QJsonDocument doc = QJsonDocument::fromJson(request.body);
+            if (!doc.isNull() && doc.isObject()) {
+                if (doc.object().contains("error")) {
+                    request.error = errorMessage(doc.object()["error"]);
                 } else {
-                    qWarning() << "LLMInterface: Empty candidates in Gemini response";
-                    emit error(tr("Gemini returned empty response. Check your API quota."));
+                    request.text = responseText(doc.object(), false);
+                    if (request.text.isEmpty())
+                        qWarning() << "LLMInterface: No text in response:" << request.body;
                 }
+            } else {
+                qWarning() << "LLMInterface: Failed to parse JSON response";
             }
+        }
 
-            // Cleanup: Strip <think> tags and their content if the model ignored our instructions
-            int thinkStart = result.indexOf("<think>");
-            while (thinkStart != -1) {
-                int thinkEnd = result.indexOf("</think>", thinkStart);
-                if (thinkEnd != -1) {
-                    result.remove(thinkStart, (thinkEnd + 8) - thinkStart);
-                } else {
-                    result.remove(thinkStart, result.length() - thinkStart);
-                }
-                thinkStart = result.indexOf("<think>");
-            }
-        } else {
-            qWarning() << "LLMInterface: Failed to parse JSON response";
+        if (!request.error.isEmpty()) {
+            qWarning() << "LLMInterface: API error:" << request.error;
+            emit error(tr("%1 API error: %2").arg(settings_->llmProvider(), request.error));
+        } else if (request.text.isEmpty() && settings_->llmProvider() == "Google Gemini") {
+            emit error(tr("Gemini returned empty response. Check your API quota."));
         }
+
+        // Cleanup: Strip <think> tags and their content if the model ignored our instructions
+        result = withoutThinking(request.text);
+    } else if (reply->error() == QNetworkReply::OperationCanceledError) {
+        // cancelVerification() disconnects its replies before aborting them,
+        // so this is the idle timeout, on every attempt the chunk had
+        qWarning() << "LLMInterface: Chunk" << index << "timed out" << chunks_[index].attempts << "times";
+        emit error(tr("%1 did not answer within %2 seconds, gave up after %3 attempts")
+                       .arg(settings_->llmProvider()).arg(IDLE_TIMEOUT_MS / 1000).arg(MAX_ATTEMPTS));
     } else {
-        if (reply->error() != QNetworkReply::OperationCanceledError) {
-            QByteArray errorBody = reply->readAll();
-            qWarning() << "LLMInterface: Network error for chunk" << index << ":" << reply->errorString();
-            qWarning() << "LLMInterface: HTTP Status:" << reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-            qWarning() << "LLMInterface: Error response body:" << errorBody;
-
-            QString errorMsg = reply->errorString();
-            // Try to parse error details from response body
-            QJsonDocument errorDoc = QJsonDocument::fromJson(errorBody);
-            if (!errorDoc.isNull() && errorDoc.isObject()) {
-                QJsonObject errorObj = errorDoc.object();
-                if (errorObj.contains("error")) {
-                    QJsonValue errorValue = errorObj["error"];
-                    if (errorValue.isString()) {
-                        errorMsg += QString(": %1").arg(errorValue.toString());
-                    } else if (errorValue.isObject()) {
-                        QString detailMsg = errorValue.toObject()["message"].toString();
-                        if (!detailMsg.isEmpty()) {
-                            errorMsg += QString(": %1").arg(detailMsg);
-                        }
-                    }
-                }
+        QByteArray errorBody = reply->readAll();
+        qWarning() << "LLMInterface: Network error for chunk" << index << ":" << reply->errorString();
+        qWarning() << "LLMInterface: HTTP Status:" << reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        qWarning() << "LLMInterface: Error response body:" << errorBody;
+
+        QString errorMsg = reply->errorString();
+        // Try to parse error details from response body
+        QJsonDocument errorDoc = QJsonDocument::fromJson(errorBody);
+        if (!errorDoc.isNull() && errorDoc.isObject() && errorDoc.object().contains("error")) {
+            QString detailMsg = errorMessage(errorDoc.object()["error"]);
+            if (!detailMsg.isEmpty()) {
+                errorMsg += QString(": %1").arg(detailMsg);
             }
-            emit error(tr("Network error: %1").arg(errorMsg));
         }
+        emit error(tr("Network error: %1").arg(errorMsg));
     }
 
-    if (!result.isEmpty()) {
+    if (!result.trimmed().isEmpty()) {
         chunks_[index].refinedTranslation = result.trimmed();
+        refinedChunks_++;
+        if (request.error.isEmpty() && !chunks_[index].cacheKey.isEmpty())
+            cache_.insert(chunks_[index].cacheKey, chunks_[index].refinedTranslation);
     }
 
     reply->deleteLater();
@@ -304,17 +569,12 @@ void LLMInterface::handleReply(QNetworkReply *reply) {
     completedCount_++;
     qDebug() << "LLMInterface: Chunk" << index << "done." << completedCount_ << "/" << chunks_.size();
 
-    // Construct current full text from completed AND in-progress chunks
-    QString currentFullText;
-    for (const auto& chunk : chunks_) {
-        currentFullText += chunk.refinedTranslation + "\n\n";
-    }
-    emit partialResultReady(currentFullText.trimmed());
+    showChunk(index);
     emit verificationProgress(completedCount_, chunks_.size());
 
     if (completedCount_ == chunks_.size()) {
         qDebug() << "LLMInterface: All chunks completed.";
-        emit verificationReady(currentFullText.trimmed());
+        emit verificationReady(refinedText());
     } else {
         processQueue();
     }
@@ -333,7 +593,7 @@ void LLMInterface::callOpenAI(int index, const QString &prompt) {
     QNetworkRequest request(url);
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     request.setRawHeader("Authorization", QString("Bearer %1").arg(apiKey).toUtf8());
-    request.setTransferTimeout(30000);
+    request.setTransferTimeout(IDLE_TIMEOUT_MS);
 
     QJsonObject message;
     message["role"] = "user";
@@ -346,10 +606,9 @@ void LLMInterface::callOpenAI(int index, const QString &prompt) {
     json["model"] = settings_->llmModel().isEmpty() ? "gpt-4o-mini" : settings_->llmModel();
     json["messages"] = messages;
     json["temperature"] = 0.3;
+    json["stream"] = true;
 
-    QNetworkReply *reply = networkManager_->post(request, QJsonDocument(json).toJson());
-    activeRequests_.insert(reply, index);
-    connect(reply, &QNetworkReply::finished, this, [this, reply]() { handleReply(reply); });
+    post(index, request, QJsonDocument(json).toJson());
 }
 
 void LLMInterface::callClaude(int index, const QString &prompt) {
@@ -366,7 +625,7 @@ void LLMInterface::callClaude(int index, const QString &prompt) {
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     request.setRawHeader("x-api-key", apiKey.toUtf8());
     request.setRawHeader("anthropic-version", "2023-06-01");
-    request.setTransferTimeout(30000);
+    request.setTransferTimeout(IDLE_TIMEOUT_MS);
 
     QJsonObject message;
     message["role"] = "user";
@@ -379,10 +638,9 @@ void LLMInterface::callClaude(int index, const QString &prompt) {
     json["model"] = settings_->llmModel().isEmpty() ? "claude-3-haiku-20240307" : settings_->llmModel();
     json["max_tokens"] = 4096;
     json["messages"] = messages;
+    json["stream"] = true;
 
-    QNetworkReply *reply = networkManager_->post(request, QJsonDocument(json).toJson());
-    activeRequests_.insert(reply, index);
-    connect(reply, &QNetworkReply::finished, this, [this, reply]() { handleReply(reply); });
+    post(index, request, QJsonDocument(json).toJson());
 }
 
 void LLMInterface::callGoogleGemini(int index, const QString &prompt) {
@@ -393,13 +651,13 @@ void LLMInterface::callGoogleGemini(int index, const QString &prompt) {
     }
 
     QString model = settings_->llmModel().isEmpty() ? "gemini-1.5-flash" : settings_->llmModel();
-    QUrl url(QString("https://generativelanguage.googleapis.com/v1beta/models/%1:generateContent?key=%2")
+    QUrl url(QString("https://generativelanguage.googleapis.com/v1beta/models/%1:streamGenerateContent?alt=sse&key=%2")
              .arg(model, apiKey));
     qDebug() << "LLMInterface: Posting to Google Gemini";
 
     QNetworkRequest request(url);
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    request.setTransferTimeout(30000);
+    request.setTransferTimeout(IDLE_TIMEOUT_MS);
 
     QJsonObject textPart;
     textPart["text"] = prompt;
@@ -416,19 +674,27 @@ void LLMInterface::callGoogleGemini(int index, const QString &prompt) {
     QJsonObject json;
     json["contents"] = contents;
 
-    QNetworkReply *reply = networkManager_->post(request, QJsonDocument(json).toJson());
-    activeRequests_.insert(reply, index);
-    connect(reply, &QNetworkReply::finished, this, [this, reply]() { handleReply(reply); });
+    post(index, request, QJsonDocument(json).toJson());
 }
 
 // Cancel any ongoing verification
 void LLMInterface::cancelVerification() {
     qDebug() << "LLMInterface: Cancelling verification";
+    abortRequests();
+    chunks_.clear();
+    units_.clear();
+    lines_.clear();
+    offsets_.reset(0);
+    completedCount_ = 0;
+}
 
+void LLMInterface::abortRequests() {
     // Copy keys and clear map first to prevent iterator invalidation
     // because abort() might trigger finished() signal which modifies activeRequests_
     QList<QNetworkReply*> replies = activeRequests_.keys();
     activeRequests_.clear();
+    ready_.clear();
+    generation_++; // Drop retries still waiting for their timer
 
     for (QNetworkReply* reply : replies) {
         if (reply) {
@@ -437,9 +703,6 @@ void LLMInterface::cancelVerification() {
             reply->deleteLater();
         }
     }
-
-    chunks_.clear();
-    completedCount_ = 0;
 }
 
 void LLMInterface::discoverLocalModels() {
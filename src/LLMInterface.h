@@ -8,8 +8,13 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
-#include <QMap>
 #include <QList>
+#include <QHash>
+#include <QQueue>
+#include <QVector>
+#include "AdaptiveConcurrency.h"
+#include "LLMCache.h"
+#include "OffsetTable.h"
 #include "settings/Settings.h"
 
 class LLMInterface : public QObject {
@@ -17,40 +22,126 @@ class LLMInterface : public QObject {
 public:
     explicit LLMInterface(Settings *settings, QObject *parent = nullptr);
 
-    void verifyTranslation(const QString &sourceText, const QString &translatedText);
+    // Refines `translatedText`, a line per paragraph, and answers with
+    // verificationReady(): the same lines, with the refined units put in.
+    // `confidence` holds, per line, the model's confidence in each sentence
+    // (see Translation::sentenceConfidences()); it may be empty.
+    void verifyTranslation(const QString &sourceText, const QString &translatedText,
+                           const QVector<QVector<float>> &confidence = {});
     void cancelVerification();
+    // Whether verifyTranslation() makes use of `confidence`: only when it
+    // picks the sentences to refine (llm_refine_threshold)
+    bool usesConfidence() const;
     void discoverLocalModels();
     void testConnection();
 
+    // The text of the verification in progress: the current text of every
+    // chunk (see partialResultReady()), separated by blank lines. Chunks only
+    // hold the units being refined, a line each. O(text), for a consumer
+    // that starts following partialResultReady() late.
+    QString currentText() const;
+    // Where chunk `chunkIndex` starts in currentText(), in O(log chunks)
+    int chunkOffset(int chunkIndex) const;
+
+    // Chunks taken from the cache, and refined by the provider, since construction
+    int cachedChunks() const;
+    int refinedChunks() const;
+    // Sentences that looked fine and kept their machine translation, since construction
+    int skippedSentences() const;
+
 signals:
     void verificationStarted();
     void verificationProgress(int completed, int total);
-    void partialResultReady(QString suggestion);
+    // Chunk `chunkIndex` now reads `text`, which replaces the `replaced`
+    // characters at `offset` in currentText(). Emitted as the answer
+    // streams in, and when the chunk is done (or falls back to the machine
+    // translation), so consumers can patch just that region.
+    void partialResultReady(int chunkIndex, int offset, int replaced, QString text);
     void verificationReady(QString llmSuggestion);
     void modelsDiscovered(QStringList models);
     void connectionTestResult(bool success, QString message);
     void error(QString message);
 
 private slots:
+    void handleReadyRead(QNetworkReply *reply);
     void handleReply(QNetworkReply *reply);
 
 private:
+    // What the LLM sees as one line: a paragraph, or a sentence of one
+    struct Unit {
+        int line;  // Of the translated text
+        int begin; // Characters [begin, end) of that line
+        int end;
+        QString source;
+        QString translation;
+    };
+
     struct Chunk {
         int index;
+        int firstUnit = 0;
+        int unitCount = 0; // Lines of source and machineTranslation
         QString source;
         QString machineTranslation;
         QString refinedTranslation;
         bool completed = false;
+        int attempts = 0; // Requests sent that the server pushed back on
+        QString partial;  // Streamed so far, while a request is in flight
+        QByteArray cacheKey; // Empty if the cache is off
     };
 
+    struct Request {
+        int chunkIndex;
+        quint64 ticket;     // From AdaptiveConcurrency::started()
+        QByteArray body;    // All of the response so far
+        QByteArray pending; // Start of a line still to come
+        QString text;       // Answer so far
+        QString error;      // Reported inside the response
+    };
+
+    // ~600-700 tokens, safe for 32k context models
+    static constexpr int CHUNK_SIZE = 2000;
+
+    // Responses are streamed, and Qt restarts the transfer timeout whenever
+    // data arrives: this is how long a provider may stay silent, the time
+    // to read the prompt (and maybe load the model) included.
+    static constexpr int IDLE_TIMEOUT_MS = 60000;
+
+    // Requests per chunk before a server that keeps pushing back counts as an error
+    static constexpr int MAX_ATTEMPTS = 4;
+    static constexpr int RETRY_DELAY_MS = 1000; // Doubled for every further attempt
+    static constexpr int MAX_RETRY_DELAY_MS = 60000;
+
     Settings *settings_;
     QNetworkAccessManager *networkManager_;
+    QStringList lines_; // Machine translation being refined
+    QVector<Unit> units_;
     QList<Chunk> chunks_;
-    QMap<QNetworkReply*, int> activeRequests_;
+    QQueue<int> ready_; // Chunks to send, in order
+    QHash<QNetworkReply*, Request> activeRequests_;
+    AdaptiveConcurrency concurrency_;
+    LLMCache cache_;
+    OffsetTable offsets_; // Length of each chunk in currentText(), with the blank line before it
     int completedCount_ = 0;
+    int cachedChunks_ = 0;
+    int refinedChunks_ = 0;
+    int skippedSentences_ = 0;
+    int generation_ = 0; // Changes with every verification, so late retries of an old one are ignored
 
+    int maxConcurrent() const;
+    void selectUnits(const QString &sourceText, const QString &translatedText,
+                     const QVector<QVector<float>> &confidence);
+    QString refinedText() const;
     void processQueue();
     void sendRequest(int chunkIndex);
+    void post(int chunkIndex, const QNetworkRequest &request, const QByteArray &data);
+    // Parses the complete lines of `request.pending` (all of it if the reply
+    // is `finished`) and adds their text to `request.text`. True if any.
+    bool readStream(Request &request, bool finished);
+    QString responseText(const QJsonObject &response, bool streamed) const;
+    const QString &chunkText(int chunkIndex) const;
+    void showChunk(int chunkIndex);
+    bool retry(QNetworkReply *reply, int chunkIndex);
+    void abortRequests();
     void callOllama(int chunkIndex, const QString &prompt);
     void callLMStudio(int chunkIndex, const QString &prompt);
     void callOpenAI(int chunkIndex, const QString &prompt);
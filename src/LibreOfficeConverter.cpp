@@ -0,0 +1,197 @@
+#include "LibreOfficeConverter.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QUrl>
+#include <QDebug>
+
+LibreOfficeConverter *LibreOfficeConverter::instance() {
+    // Lives as long as the application. Its processes are driven by the main
+    // thread's event loop, wherever the conversions are requested from.
+    static LibreOfficeConverter *converter = []() {
+        auto *c = new LibreOfficeConverter();
+        c->moveToThread(QCoreApplication::instance()->thread());
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, c, &LibreOfficeConverter::shutdown);
+        return c;
+    }();
+    return converter;
+}
+
+LibreOfficeConverter::LibreOfficeConverter(QObject *parent)
+    : QObject(parent), process_(nullptr), timeout_(nullptr),
+      profileDir_(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/libreoffice/profile"),
+      nextId_(0) {
+}
+
+QString LibreOfficeConverter::sofficePath() {
+    static const QString path = []() {
+#ifdef Q_OS_WIN
+        // Common Windows paths for LibreOffice
+        QStringList possiblePaths = {
+            "C:/Program Files/LibreOffice/program/soffice.exe",
+            "C:/Program Files (x86)/LibreOffice/program/soffice.exe",
+            QStandardPaths::findExecutable("soffice"),
+            QStandardPaths::findExecutable("soffice.exe")
+        };
+#elif defined(Q_OS_MAC)
+        QStringList possiblePaths = {
+            "/Applications/LibreOffice.app/Contents/MacOS/soffice",
+            QStandardPaths::findExecutable("soffice")
+        };
+#else
+        // Linux
+        QStringList possiblePaths = {
+            QStandardPaths::findExecutable("soffice"),
+            QStandardPaths::findExecutable("libreoffice")
+        };
+#endif
+        for (const QString &path : possiblePaths) {
+            if (!path.isEmpty() && QFile::exists(path)) {
+                return path;
+            }
+        }
+        return QString();
+    }();
+    return path;
+}
+
+int LibreOfficeConverter::submit(const QString &inputPath, const QString &format) {
+    int id = nextId_++;
+    {
+        QMutexLocker lock(&mutex_);
+        queue_.enqueue({id, inputPath, format});
+    }
+    QMetaObject::invokeMethod(this, [this]() { start(); }, Qt::QueuedConnection);
+    return id;
+}
+
+QString LibreOfficeConverter::convert(const QString &inputPath, const QString &format, QString *errorMessage) {
+    QEventLoop loop;
+    QString result;
+    int id = -1;
+
+    // Connected to the loop, so answers are delivered to this thread, and
+    // never before id is set.
+    auto onConverted = connect(this, &LibreOfficeConverter::converted, &loop, [&](int job, QString outputPath) {
+        if (job == id) {
+            result = outputPath;
+            loop.quit();
+        }
+    });
+    auto onFailed = connect(this, &LibreOfficeConverter::failed, &loop, [&](int job, QString message) {
+        if (job == id) {
+            if (errorMessage)
+                *errorMessage = message;
+            loop.quit();
+        }
+    });
+
+    id = submit(inputPath, format);
+    loop.exec();
+
+    disconnect(onConverted);
+    disconnect(onFailed);
+    return result;
+}
+
+void LibreOfficeConverter::start() {
+    // One conversion at a time: the next one starts when this one finishes
+    if (process_)
+        return;
+
+    {
+        QMutexLocker lock(&mutex_);
+        if (queue_.isEmpty())
+            return;
+        job_ = queue_.dequeue();
+    }
+
+    if (sofficePath().isEmpty()) {
+        emit failed(job_.id, tr("LibreOffice not found. Please install LibreOffice to convert PDF files. "
+                                "Download from: https://www.libreoffice.org/download/"));
+        start();
+        return;
+    }
+
+    QTemporaryDir outputDir;
+    if (!outputDir.isValid()) {
+        emit failed(job_.id, tr("Could not create temporary directory for PDF conversion."));
+        start();
+        return;
+    }
+    outputDir.setAutoRemove(false);
+    outputDir_ = outputDir.path();
+
+    QDir().mkpath(profileDir_);
+    QStringList args;
+    args << "-env:UserInstallation=" + QUrl::fromLocalFile(profileDir_).toString()
+         << "--headless"
+         << "--convert-to" << job_.format
+         << "--outdir" << outputDir_
+         << job_.inputPath;
+
+    process_ = new QProcess(this);
+    timeout_ = new QTimer(this);
+    timeout_->setSingleShot(true);
+    connect(timeout_, &QTimer::timeout, process_, &QProcess::kill);
+    connect(process_, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, [this]() {
+        finish();
+    });
+    connect(process_, &QProcess::errorOccurred, this, [this](QProcess::ProcessError processError) {
+        if (processError == QProcess::FailedToStart)
+            finish();
+    });
+
+    qDebug() << "Converting" << job_.inputPath << "with LibreOffice";
+    timeout_->start(TIMEOUT_MS);
+    process_->start(sofficePath(), args);
+}
+
+void LibreOfficeConverter::finish() {
+    if (!process_)
+        return;
+
+    QString failure;
+    if (process_->error() == QProcess::FailedToStart) {
+        failure = tr("Failed to start LibreOffice for PDF conversion.");
+    } else if (!timeout_->isActive()) {
+        failure = tr("LibreOffice PDF conversion timed out.");
+    } else if (process_->exitStatus() != QProcess::NormalExit || process_->exitCode() != 0) {
+        failure = tr("LibreOffice conversion failed: %1").arg(QString(process_->readAllStandardError()));
+    }
+
+    QString outputPath = outputDir_ + "/" + QFileInfo(job_.inputPath).completeBaseName() + "." + job_.format;
+    if (failure.isEmpty() && QFile::exists(outputPath)) {
+        emit converted(job_.id, outputPath);
+    } else {
+        QDir(outputDir_).removeRecursively();
+        emit failed(job_.id, failure.isEmpty() ? tr("PDF conversion produced no output file.") : failure);
+    }
+
+    timeout_->stop();
+    timeout_->deleteLater();
+    process_->deleteLater();
+    timeout_ = nullptr;
+    process_ = nullptr;
+
+    // Whatever was queued in the meantime
+    start();
+}
+
+void LibreOfficeConverter::shutdown() {
+    {
+        QMutexLocker lock(&mutex_);
+        queue_.clear();
+    }
+    if (process_) {
+        process_->kill();
+        process_->waitForFinished(5000);
+    }
+}
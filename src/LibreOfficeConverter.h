@@ -0,0 +1,75 @@
+#ifndef LIBREOFFICECONVERTER_H
+#define LIBREOFFICECONVERTER_H
+
+#include <QObject>
+#include <QString>
+#include <QQueue>
+#include <QMutex>
+#include <atomic>
+
+class QProcess;
+class QTimer;
+
+/**
+ * Converts documents with a headless LibreOffice (soffice --convert-to).
+ *
+ * The first start of LibreOffice with a new profile is by far the slowest,
+ * so all conversions use one persistent profile in the cache directory, which
+ * is only ever created once. As two soffice processes cannot share a profile,
+ * conversions are queued and run one after the other.
+ *
+ * There is one converter per application, living in the main thread.
+ */
+class LibreOfficeConverter : public QObject {
+    Q_OBJECT
+public:
+    static LibreOfficeConverter *instance();
+
+    // Path to soffice, or empty if LibreOffice is not installed. Looked up once.
+    static QString sofficePath();
+
+    /**
+     * Queues the conversion of `inputPath` to `format` (a file extension such
+     * as "docx"). The result goes to a new temporary directory that is the
+     * caller's to remove. Answered by converted() or failed() with the returned
+     * id. Safe to call from any thread.
+     */
+    int submit(const QString &inputPath, const QString &format);
+
+    /**
+     * Blocking version of submit(), runs a local event loop. Returns the path
+     * of the converted file, or an empty string and the reason in `errorMessage`.
+     */
+    QString convert(const QString &inputPath, const QString &format, QString *errorMessage = nullptr);
+
+signals:
+    void converted(int id, QString outputPath);
+    void failed(int id, QString message);
+
+private:
+    explicit LibreOfficeConverter(QObject *parent = nullptr);
+
+    struct Job {
+        int id = -1;
+        QString inputPath;
+        QString format;
+    };
+
+    void start();
+    void finish();
+    void shutdown();
+
+    // Time a single conversion may take
+    static constexpr int TIMEOUT_MS = 300000;
+
+    QMutex mutex_;
+    QQueue<Job> queue_; // Guarded by mutex_, everything else is main thread only
+    QProcess *process_;  // Converting job_, or nullptr
+    QTimer *timeout_;
+    Job job_;
+    QString profileDir_;
+    QString outputDir_;
+    std::atomic<int> nextId_;
+};
+
+#endif // LIBREOFFICECONVERTER_H
@@ -41,6 +41,7 @@ int countWords(std::string_view input) {
 struct TranslationInput {
     std::string text;
     marian::bergamot::ResponseOptions options;
+    int id = -1; // Only used for enqueue()d inputs
 };
 
 struct ModelDescription {
@@ -52,7 +53,9 @@ MarianInterface::MarianInterface(QObject *parent)
     : QObject(parent)
     , pendingInput_(nullptr)
     , pendingModel_(nullptr)
-    , pendingShutdown_(false) {
+    , pendingBatchCancel_(false)
+    , pendingShutdown_(false)
+    , nextBatchId_(0) {
 
     // This worker is the only thread that can interact with Marian. Right now
     // it basically uses marian::bergamot::Service's non-blocking interface
@@ -66,6 +69,8 @@ MarianInterface::MarianInterface(QObject *parent)
     // indicates whether there are 0, 1, or 2 commands pending. If a command
     // is pending but both "queues" are empty, we'll treat that as a shutdown
     // request.
+    // Inputs queued with enqueue() are the exception: those are all passed on
+    // to the service straight away, and answered from the service's threads.
     worker_ = std::thread([&]() {
         std::unique_ptr<marian::bergamot::AsyncService> service;
         std::shared_ptr<marian::bergamot::TranslationModel> model;
@@ -75,21 +80,37 @@ MarianInterface::MarianInterface(QObject *parent)
         while (true) {
             std::unique_ptr<ModelDescription> modelChange;
             std::unique_ptr<TranslationInput> input;
+            std::vector<std::unique_ptr<TranslationInput>> batch;
+            bool batchCancel = false;
+            bool batchDropped = false;
 
             {
                 // Wait for work
                 std::unique_lock<std::mutex> lock(mutex_);
-                cv_.wait(lock, [&]{ return pendingModel_ || pendingInput_ || pendingShutdown_; });
+                cv_.wait(lock, [&]{ return pendingModel_ || pendingInput_ || !pendingBatch_.empty() || pendingBatchCancel_ || pendingShutdown_; });
 
                 // First check whether the command is loading a new model
-                if (pendingModel_)
+                // Queued batch inputs were meant for the old model, so they
+                // are dropped with it.
+                if (pendingModel_) {
                     modelChange = std::move(pendingModel_);
+                    batchDropped = !pendingBatch_.empty();
+                    pendingBatch_.clear();
+                }
                 
                 // Second check whether command is translating something.
                 // Note: else if because we only process one command per
                 // iteration otherwise commandIssued_ would go out of sync.
                 else if (pendingInput_)
                     input = std::move(pendingInput_);
+
+                // Third, dropping queued batch inputs goes before adding
+                // new ones, as those are meant to survive the cancel.
+                else if (pendingBatchCancel_)
+                    std::swap(batchCancel, pendingBatchCancel_);
+
+                else if (!pendingBatch_.empty())
+                    std::swap(batch, pendingBatch_);
                 
                 // Command without any pending change -> poison.
                 else
@@ -106,6 +127,16 @@ MarianInterface::MarianInterface(QObject *parent)
                     serviceConfig.numWorkers = modelChange->settings.cpu_threads;
                     serviceConfig.cacheSize = modelChange->settings.translation_cache ? kTranslationCacheSize : 0;
                     
+                    // Batch inputs the old service has not answered yet never
+                    // will be. Whoever is waiting for them has to know.
+                    {
+                        std::unique_lock<std::mutex> lock(batchMutex_);
+                        batchDropped = batchDropped || !batchInFlight_.empty();
+                        batchInFlight_.clear();
+                    }
+                    if (batchDropped)
+                        emit error(tr("The translation model was changed while a document was being translated"));
+
                     // Free up old service first (see https://github.com/browsermt/bergamot-translator/issues/290)
                     // Calling clear to remove any pending translations so we
                     // do not have to wait for those when AsyncService is destroyed.
@@ -152,6 +183,35 @@ MarianInterface::MarianInterface(QObject *parent)
                     } else {
                         // TODO: What? Raise error? Set model_ to ""?
                     }
+                } else if (batchCancel) {
+                    if (service)
+                        service->clear();
+                    std::unique_lock<std::mutex> lock(batchMutex_);
+                    batchInFlight_.clear();
+                } else if (!batch.empty()) {
+                    if (!model)
+                        throw std::runtime_error("Could not translate: no model has been loaded");
+
+                    for (auto &item : batch) {
+                        int id = item->id;
+                        int words = countWords(item->text);
+                        auto start = std::chrono::steady_clock::now();
+                        {
+                            std::unique_lock<std::mutex> lock(batchMutex_);
+                            batchInFlight_.insert(id);
+                        }
+                        // Callback is called from one of the service's worker
+                        // threads, the signal is queued for the receiver.
+                        service->translate(model, std::move(item->text), [this, id, words, start] (auto &&val) {
+                            std::chrono::duration<double> elapsedSeconds = std::chrono::steady_clock::now() - start;
+                            int translationSpeed = std::ceil(words / elapsedSeconds.count());
+                            {
+                                std::unique_lock<std::mutex> lock(batchMutex_);
+                                batchInFlight_.erase(id);
+                            }
+                            emit batchTranslationReady(id, Translation(std::move(val), translationSpeed));
+                        }, item->options);
+                    }
                 }
             } catch (const std::runtime_error &e) {
                 emit error(QString::fromStdString(e.what()));
@@ -199,6 +259,32 @@ void MarianInterface::translate(QString in, bool HTML) {
     cv_.notify_one();
 }
 
+int MarianInterface::enqueue(QString in, bool HTML, BatchExtras extras) {
+    if (model_.isEmpty())
+        return -1;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_ptr<TranslationInput> input(new TranslationInput{in.toStdString(), marian::bergamot::ResponseOptions{}});
+    // Restoring the HTML markup around the translation needs the alignments
+    input->options.alignment = HTML || extras.testFlag(Alignments);
+    input->options.qualityScores = extras.testFlag(QualityScores);
+    input->options.HTML = HTML;
+    input->id = nextBatchId_++;
+
+    int id = input->id;
+    pendingBatch_.push_back(std::move(input));
+
+    cv_.notify_one();
+    return id;
+}
+
+void MarianInterface::cancelBatch() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pendingBatch_.clear();
+    pendingBatchCancel_ = true;
+    cv_.notify_one();
+}
+
 MarianInterface::~MarianInterface() {
     // Remove all pending changes and unlock worker (which will then break.)
     {
@@ -207,6 +293,8 @@ MarianInterface::~MarianInterface() {
         pendingShutdown_ = true;
         pendingModel_.reset();
         pendingInput_.reset();
+        pendingBatch_.clear();
+        pendingBatchCancel_ = false;
 
         cv_.notify_one();
     }
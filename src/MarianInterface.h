@@ -9,6 +9,8 @@
 #include <mutex>
 #include <thread>
 #include <memory>
+#include <unordered_set>
+#include <vector>
 
 struct ModelDescription;
 struct TranslationInput;
@@ -20,11 +22,19 @@ class MarianInterface : public QObject {
 private:
     std::unique_ptr<TranslationInput> pendingInput_;
     std::unique_ptr<ModelDescription> pendingModel_;
+    std::vector<std::unique_ptr<TranslationInput>> pendingBatch_;
+    bool pendingBatchCancel_;
     bool pendingShutdown_;
+    int nextBatchId_;
 
     std::mutex mutex_;
     std::condition_variable cv_;
 
+    // Ids of enqueue()d inputs handed to the service and not answered yet.
+    // Guarded by batchMutex_, as answers come from the service's threads.
+    std::unordered_set<int> batchInFlight_;
+    std::mutex batchMutex_;
+
     std::thread worker_;
     QString model_;
 public:
@@ -33,10 +43,41 @@ public:
     QString const &model() const;
     void setModel(QString path_to_model_dir, const translateLocally::marianSettings& settings);
     void translate(QString in, bool HTML=false);
+
+    // What enqueue()d translations come with besides the text. Each costs
+    // extra work per sentence, so only ask for what is used.
+    enum BatchExtra {
+        NoExtras = 0x0,
+        Alignments = 0x1,   // Translation::alignments()
+        QualityScores = 0x2 // Translation::sentenceConfidences()
+    };
+    Q_DECLARE_FLAGS(BatchExtras, BatchExtra)
+
+    /**
+     * Queues `in` for translation next to all other queued inputs. Unlike
+     * translate(), queued inputs do not replace each other: they are all
+     * handed to the service at once so they are translated concurrently, and
+     * each is answered by a batchTranslationReady() carrying the returned id,
+     * with the `extras` asked for. HTML input always comes with alignments,
+     * which the service needs to put the markup back.
+     * Returns -1 if there is no model to translate with. If the model is
+     * changed before all queued inputs are answered, the rest are dropped
+     * and error() is emitted instead.
+     */
+    int enqueue(QString in, bool HTML=false, BatchExtras extras=NoExtras);
+
+    /**
+     * Drops queued inputs that the service has not started on yet. Inputs
+     * that are already being translated will still be answered.
+     */
+    void cancelBatch();
 signals:
     void translationReady(Translation translation);
+    void batchTranslationReady(int id, Translation translation);
     void pendingChanged(bool isBusy); // Disables issuing another translation while we are busy.
     void error(QString message);
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(MarianInterface::BatchExtras)
+
 #endif // MARIANINTERFACE_H
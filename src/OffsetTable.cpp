@@ -0,0 +1,28 @@
+#include "OffsetTable.h"
+
+void OffsetTable::reset(int count) {
+    lengths_.fill(0, count);
+    tree_.fill(0, count + 1);
+}
+
+int OffsetTable::size() const {
+    return lengths_.size();
+}
+
+void OffsetTable::setLength(int index, int length) {
+    int change = length - lengths_[index];
+    lengths_[index] = length;
+    for (int i = index + 1; i < tree_.size(); i += i & -i)
+        tree_[i] += change;
+}
+
+int OffsetTable::length(int index) const {
+    return lengths_[index];
+}
+
+int OffsetTable::offset(int index) const {
+    int sum = 0;
+    for (int i = index; i > 0; i -= i & -i)
+        sum += tree_[i];
+    return sum;
+}
@@ -0,0 +1,28 @@
+#ifndef OFFSETTABLE_H
+#define OFFSETTABLE_H
+
+#include <QVector>
+
+/**
+ * Where each of a row of pieces starts when they are laid end to end, while
+ * their lengths keep changing: a Fenwick tree over the lengths, so changing
+ * one length and finding one offset both take O(log n) instead of adding up
+ * everything before it.
+ */
+class OffsetTable {
+public:
+    // `count` pieces, all of length 0
+    void reset(int count);
+    int size() const;
+
+    void setLength(int index, int length);
+    int length(int index) const;
+    // Sum of the lengths of the pieces before `index`; offset(size()) is the total
+    int offset(int index) const;
+
+private:
+    QVector<int> lengths_;
+    QVector<int> tree_; // 1-based: tree_[i] sums the lengths_ of (i - lowbit(i), i]
+};
+
+#endif // OFFSETTABLE_H
@@ -0,0 +1,102 @@
+#include "PdfLayout.h"
+
+#ifdef HAVE_POPPLER
+#include <poppler-page.h>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+struct Line {
+    QRectF rect;
+    QString text;
+};
+}
+
+PdfLayout::Page PdfLayout::readPage(const poppler::page &page) {
+    Page result;
+    poppler::rectf pageRect = page.page_rect();
+    result.size = QSizeF(pageRect.width(), pageRect.height());
+
+    // Words come in reading order. A word continues the current line if it
+    // overlaps it vertically by at least half its height and follows it
+    // closely enough on the right; anything else (a new line, the next
+    // column) starts a new line.
+    QVector<Line> lines;
+    Line line;
+    bool lineOpen = false;
+    bool spaceAfter = false;
+
+    for (const poppler::text_box &box : page.text_list()) {
+        poppler::byte_array bytes = box.text().to_utf8();
+        QString word = QString::fromUtf8(bytes.data(), static_cast<int>(bytes.size())).simplified();
+        if (word.isEmpty())
+            continue;
+
+        poppler::rectf bbox = box.bbox();
+        QRectF rect(bbox.x(), bbox.y(), bbox.width(), bbox.height());
+
+        if (lineOpen) {
+            qreal overlap = std::min(line.rect.bottom(), rect.bottom()) - std::max(line.rect.top(), rect.top());
+            qreal gap = rect.left() - line.rect.right();
+            bool sameLine = overlap > 0.5 * std::min(line.rect.height(), rect.height()) &&
+                            gap > -rect.height() && gap < 2 * rect.height();
+            if (sameLine) {
+                if (spaceAfter || gap > 0.2 * rect.height())
+                    line.text += ' ';
+                line.text += word;
+                line.rect |= rect;
+            } else {
+                lines.append(line);
+                lineOpen = false;
+            }
+        }
+
+        if (!lineOpen) {
+            line = {rect, word};
+            lineOpen = true;
+        }
+        spaceAfter = box.has_space_after();
+    }
+    if (lineOpen)
+        lines.append(line);
+
+    // Lines make up a block when they follow each other without much space in
+    // between, have about the same height and overlap horizontally.
+    Block block;
+    QRectF lastLine;
+    bool blockOpen = false;
+
+    for (const Line &current : lines) {
+        if (blockOpen) {
+            qreal height = lastLine.height();
+            qreal gap = current.rect.top() - lastLine.bottom();
+            bool sameBlock = gap > -0.5 * height && gap < 0.8 * height &&
+                             std::abs(current.rect.height() - height) < 0.25 * height &&
+                             current.rect.left() < block.rect.right() && current.rect.right() > block.rect.left();
+            if (sameBlock) {
+                // Undo hyphenation at the end of a line
+                if (block.text.endsWith('-') && current.text.at(0).isLower())
+                    block.text.chop(1);
+                else
+                    block.text += ' ';
+                block.text += current.text;
+                block.rect |= current.rect;
+            } else {
+                result.blocks.append(block);
+                blockOpen = false;
+            }
+        }
+
+        if (!blockOpen) {
+            // Word boxes are about 1.2 times the font size high
+            block = {current.rect, current.rect.height() / 1.2, current.text};
+            blockOpen = true;
+        }
+        lastLine = current.rect;
+    }
+    if (blockOpen)
+        result.blocks.append(block);
+
+    return result;
+}
+#endif
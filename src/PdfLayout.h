@@ -0,0 +1,38 @@
+#ifndef PDFLAYOUT_H
+#define PDFLAYOUT_H
+
+#ifdef HAVE_POPPLER
+#include <QRectF>
+#include <QSizeF>
+#include <QString>
+#include <QVector>
+
+namespace poppler {
+class page;
+}
+
+/**
+ * Text layout of a PDF page as Poppler reports it (words with their boxes),
+ * grouped into lines and the lines into blocks: paragraphs, headings, table
+ * cells. DocumentSplitter translates the text of each block as a paragraph,
+ * DocumentMerger reads the same blocks again to put the translations back in
+ * place. Both must see the same blocks, so both go through readPage().
+ */
+class PdfLayout {
+public:
+    struct Block {
+        QRectF rect;     // In points, origin top left of the page
+        qreal fontSize;  // In points, estimated from the line height
+        QString text;    // Lines joined with spaces
+    };
+
+    struct Page {
+        QSizeF size;     // In points
+        QVector<Block> blocks;
+    };
+
+    static Page readPage(const poppler::page &page);
+};
+#endif
+
+#endif // PDFLAYOUT_H
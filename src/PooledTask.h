@@ -0,0 +1,24 @@
+#pragma once
+#include <QThreadPool>
+#include <future>
+#include <memory>
+#include <utility>
+
+namespace translateLocally {
+
+/**
+ * Runs `fn` on `pool` and returns a future for its result. Used where work is
+ * fanned out over threads but the results have to be consumed in order: keep
+ * the futures in a queue and get() them front to back.
+ * Note: don't wait on these futures from inside `pool` itself.
+ */
+template <typename Fn>
+auto runOnPool(QThreadPool *pool, Fn &&fn) -> std::future<decltype(fn())> {
+    using Result = decltype(fn());
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Fn>(fn));
+    std::future<Result> future = task->get_future();
+    pool->start([task]() { (*task)(); });
+    return future;
+}
+
+} // namespace translateLocally
@@ -0,0 +1,53 @@
+#include "ProgressMeter.h"
+#include <cmath>
+
+void ProgressMeter::start(qint64 total) {
+    total_ = total;
+    done_ = 0;
+    samples_.clear();
+    timer_.start();
+    samples_.push_back({0, 0});
+}
+
+void ProgressMeter::add(qint64 words) {
+    done_ += words;
+    qint64 now = timer_.elapsed();
+    samples_.push_back({now, done_});
+
+    // Keep one sample older than the window, so the window is always covered
+    while (samples_.size() > 2 && samples_[1].ms < now - WINDOW_MS)
+        samples_.pop_front();
+}
+
+qint64 ProgressMeter::done() const {
+    return done_;
+}
+
+qint64 ProgressMeter::total() const {
+    return total_;
+}
+
+double ProgressMeter::wordsPerSecond() const {
+    if (samples_.size() < 2)
+        return 0;
+
+    const Sample &first = samples_.front();
+    qint64 ms = timer_.elapsed() - first.ms;
+    return ms > 0 ? (done_ - first.done) * 1000.0 / ms : 0;
+}
+
+qint64 ProgressMeter::etaSeconds() const {
+    double speed = wordsPerSecond();
+    if (total_ < 0 || speed <= 0)
+        return -1;
+    return static_cast<qint64>(std::ceil((total_ - done_) / speed));
+}
+
+QString ProgressMeter::formatDuration(qint64 seconds) {
+    if (seconds >= 3600) {
+        return QString("%1:%2:%3").arg(seconds / 3600)
+            .arg(seconds / 60 % 60, 2, 10, QChar('0'))
+            .arg(seconds % 60, 2, 10, QChar('0'));
+    }
+    return QString("%1:%2").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+}
@@ -0,0 +1,43 @@
+#ifndef PROGRESSMETER_H
+#define PROGRESSMETER_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <deque>
+
+/**
+ * Words per second and time left for a document. The speed is a moving
+ * average over the last WINDOW_MS, so it follows the translation service as
+ * it speeds up (batches filling) or slows down (LLM refinement competing for
+ * the CPU) rather than averaging over the whole run.
+ */
+class ProgressMeter {
+public:
+    static constexpr qint64 WINDOW_MS = 20000;
+
+    // `total` words to do, -1 if not known
+    void start(qint64 total);
+    void add(qint64 words);
+
+    qint64 done() const;
+    qint64 total() const;
+    double wordsPerSecond() const;
+    // Seconds left at the current speed, -1 if not known (yet)
+    qint64 etaSeconds() const;
+
+    // "1:02:03" or "2:03"
+    static QString formatDuration(qint64 seconds);
+
+private:
+    struct Sample {
+        qint64 ms;
+        qint64 done;
+    };
+
+    QElapsedTimer timer_;
+    std::deque<Sample> samples_; // Oldest first, covering about WINDOW_MS
+    qint64 done_ = 0;
+    qint64 total_ = -1;
+};
+
+#endif // PROGRESSMETER_H
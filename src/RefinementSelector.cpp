@@ -0,0 +1,90 @@
+#include "RefinementSelector.h"
+#include <QRegularExpression>
+#include <QSet>
+#include <QTextBoundaryFinder>
+
+namespace {
+
+// Translations are usually this much shorter or longer than their source;
+// outside of it the score falls off with the ratio.
+constexpr double MIN_LENGTH_RATIO = 0.6;
+constexpr double MAX_LENGTH_RATIO = 1.8;
+
+// Shorter sentences ("Yes.", "Chapter 3") vary too much in length to judge
+constexpr int MIN_LENGTH_CHARS = 20;
+
+// Below this many candidate words, copying one means little
+constexpr int MIN_COPY_CANDIDATES = 3;
+
+// Words that are normally translated: lower case only, at least four letters.
+// Names, acronyms, numbers and short words are often the same in both languages.
+QSet<QString> translatableWords(const QString &text) {
+    static const QRegularExpression word("\\b\\p{Ll}{4,}\\b", QRegularExpression::UseUnicodePropertiesOption);
+    QSet<QString> words;
+    auto it = word.globalMatch(text);
+    while (it.hasNext())
+        words.insert(it.next().captured());
+    return words;
+}
+
+double lengthScore(const QString &source, const QString &translation) {
+    if (source.size() < MIN_LENGTH_CHARS && translation.size() < MIN_LENGTH_CHARS)
+        return 1;
+
+    double ratio = static_cast<double>(translation.size()) / qMax(source.size(), 1);
+    if (ratio < MIN_LENGTH_RATIO)
+        return ratio / MIN_LENGTH_RATIO;
+    if (ratio > MAX_LENGTH_RATIO)
+        return MAX_LENGTH_RATIO / ratio;
+    return 1;
+}
+
+double copyScore(const QString &source, const QString &translation) {
+    QSet<QString> candidates = translatableWords(source);
+    if (candidates.size() < MIN_COPY_CANDIDATES)
+        return 1;
+
+    QSet<QString> translated = translatableWords(translation);
+    int copied = 0;
+    for (const QString &word : candidates)
+        copied += translated.contains(word);
+    return 1.0 - static_cast<double>(copied) / candidates.size();
+}
+
+} // namespace
+
+RefinementSelector::Range RefinementSelector::trimmed(const QString &text, int begin, int end) {
+    while (begin < end && text[begin].isSpace())
+        begin++;
+    while (end > begin && text[end - 1].isSpace())
+        end--;
+    return {begin, end};
+}
+
+QVector<RefinementSelector::Range> RefinementSelector::sentences(const QString &text) {
+    QVector<Range> sentences;
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Sentence, text);
+    int begin = 0;
+    while (begin < text.size()) {
+        int end = finder.toNextBoundary();
+        if (end < 0)
+            end = text.size();
+        Range sentence = trimmed(text, begin, end);
+        if (sentence.end > sentence.begin)
+            sentences.append(sentence);
+        begin = end;
+    }
+    return sentences;
+}
+
+double RefinementSelector::score(const QString &source, const QString &translation, double modelConfidence) {
+    if (translation.trimmed().isEmpty())
+        return 0;
+    if (translation.trimmed() == source.trimmed() && translatableWords(source).size() >= MIN_COPY_CANDIDATES)
+        return 0; // Not translated at all
+
+    double score = qMin(lengthScore(source, translation), copyScore(source, translation));
+    if (modelConfidence >= 0)
+        score = qMin(score, modelConfidence);
+    return score;
+}
@@ -0,0 +1,34 @@
+#ifndef REFINEMENTSELECTOR_H
+#define REFINEMENTSELECTOR_H
+
+#include <QString>
+#include <QVector>
+
+/**
+ * Picks the sentences of a machine translation that are worth sending to the
+ * LLM. Each sentence gets a score between 0 (surely wrong) and 1 (nothing
+ * suspicious), the lowest of:
+ * - the model's confidence in it, where the translation service reports one;
+ * - how far the length of the translation is from that of the source;
+ * - how many source words were copied into the translation untranslated.
+ * Sentences scoring at least the threshold keep their machine translation.
+ */
+class RefinementSelector {
+public:
+    // Characters [begin, end) of a text
+    struct Range {
+        int begin;
+        int end;
+    };
+
+    // Sentences of `text`, without the whitespace around them; none are empty
+    static QVector<Range> sentences(const QString &text);
+
+    // [begin, end) without the whitespace at either end
+    static Range trimmed(const QString &text, int begin, int end);
+
+    // `modelConfidence` between 0 and 1, or negative if not known
+    static double score(const QString &source, const QString &translation, double modelConfidence = -1);
+};
+
+#endif // REFINEMENTSELECTOR_H
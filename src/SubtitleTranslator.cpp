@@ -0,0 +1,228 @@
+#include "SubtitleTranslator.h"
+#include "MarianInterface.h"
+#include <QEventLoop>
+#include <QDebug>
+#include <QRegularExpression>
+#include <limits>
+
+namespace {
+
+// Alignments are worth this much more than the position of a word: the
+// position only decides where there are none.
+constexpr double POSITION_WEIGHT = 0.01;
+
+bool endsSentence(const QString &cue) {
+    // Closing quotes, brackets and formatting tags may follow the punctuation
+    static const QRegularExpression sentenceEnd("[.!?…。！？♪][\"'”’)\\]\\s]*(<[^>]*>\\s*)*$");
+    return sentenceEnd.match(cue).hasMatch();
+}
+
+struct Word {
+    int begin;
+    int end;
+};
+
+QVector<Word> wordsOf(const QString &text) {
+    QVector<Word> words;
+    int i = 0;
+    while (i < text.size()) {
+        while (i < text.size() && text[i].isSpace())
+            i++;
+        int begin = i;
+        while (i < text.size() && !text[i].isSpace())
+            i++;
+        if (i > begin)
+            words.append({begin, i});
+    }
+    return words;
+}
+
+} // namespace
+
+SubtitleTranslator::SubtitleTranslator(MarianInterface *translator, QObject *parent)
+    : QObject(parent), translator_(translator), cuesDone_(0), failed_(false), cancelled_(false), loop_(nullptr) {
+}
+
+QVector<SubtitleTranslator::Sentence> SubtitleTranslator::sentences(const QStringList &cues) {
+    QVector<Sentence> sentences;
+    bool open = false;
+
+    for (int i = 0; i < cues.size(); ++i) {
+        QString text = cues[i].simplified();
+        if (text.isEmpty()) {
+            open = false;
+            sentences.append({QString(), i, {0}});
+            continue;
+        }
+
+        if (open) {
+            Sentence &sentence = sentences.last();
+            sentence.text += ' ';
+            sentence.cueBegin.append(sentence.text.size());
+            sentence.text += text;
+        } else {
+            sentences.append({text, i, {0}});
+            open = true;
+        }
+
+        if (endsSentence(text) || sentences.last().cueBegin.size() == MAX_SENTENCE_CUES)
+            open = false;
+    }
+
+    return sentences;
+}
+
+QStringList SubtitleTranslator::distribute(const Sentence &sentence, const Translation &translation) {
+    const int cues = sentence.cueBegin.size();
+    const QString text = translation.translation();
+    if (cues == 1)
+        return {text.simplified()};
+
+    const QVector<Word> words = wordsOf(text);
+    const int count = words.size();
+
+    // score[c][w]: how much translated word w belongs to cue c
+    QVector<QVector<double>> score(cues, QVector<double>(count, 0.0));
+    for (int c = 0; c < cues; ++c) {
+        int begin = sentence.cueBegin[c];
+        int end = c + 1 < cues ? sentence.cueBegin[c + 1] - 1 : sentence.text.size(); // Without the joining space
+
+        for (const WordAlignment &alignment : translation.alignments(Translation::source_to_translation, begin, end - 1)) {
+            for (int w = 0; w < count; ++w) {
+                if (words[w].begin < static_cast<int>(alignment.end) && static_cast<int>(alignment.begin) < words[w].end)
+                    score[c][w] += alignment.prob;
+            }
+        }
+
+        // Where the cue is in the sentence, relative to its length
+        double from = static_cast<double>(begin) / sentence.text.size();
+        double to = static_cast<double>(end) / sentence.text.size();
+        for (int w = 0; w < count; ++w) {
+            double center = (words[w].begin + words[w].end) / 2.0 / text.size();
+            if (center >= from && center <= to)
+                score[c][w] += POSITION_WEIGHT;
+        }
+    }
+
+    // Best split of the words into `cues` consecutive (non-empty, if there
+    // are enough words) pieces: best[c][w] is the score of giving the first w
+    // words to the first c cues.
+    const double none = -std::numeric_limits<double>::infinity();
+    const bool nonEmpty = count >= cues;
+    QVector<QVector<double>> best(cues + 1, QVector<double>(count + 1, none));
+    QVector<QVector<int>> cut(cues + 1, QVector<int>(count + 1, 0));
+    best[0][0] = 0;
+    for (int c = 1; c <= cues; ++c) {
+        for (int w = 0; w <= count; ++w) {
+            double piece = 0; // Score of words k..w-1 for cue c-1
+            for (int k = w; k >= 0; --k) {
+                if (k < w)
+                    piece += score[c - 1][k];
+                if ((nonEmpty && k == w) || best[c - 1][k] == none)
+                    continue;
+                if (best[c - 1][k] + piece > best[c][w]) {
+                    best[c][w] = best[c - 1][k] + piece;
+                    cut[c][w] = k;
+                }
+            }
+        }
+    }
+
+    QStringList pieces;
+    int end = count;
+    for (int c = cues; c > 0; --c) {
+        int begin = cut[c][end];
+        pieces.prepend(begin < end ? text.mid(words[begin].begin, words[end - 1].end - words[begin].begin).simplified()
+                                   : QString(""));
+        end = begin;
+    }
+    return pieces;
+}
+
+QStringList SubtitleTranslator::translate(const QStringList &cues) {
+    sentences_ = sentences(cues);
+    result_ = QStringList();
+    for (int i = 0; i < cues.size(); ++i)
+        result_.append(QString());
+    inFlight_.clear();
+    cuesDone_ = 0;
+    failed_ = false;
+
+    QEventLoop loop;
+    loop_ = &loop;
+
+    QList<QMetaObject::Connection> connections;
+    connections << connect(translator_, &MarianInterface::batchTranslationReady,
+                           this, &SubtitleTranslator::onTranslationReady);
+    connections << connect(translator_, &MarianInterface::error,
+                           this, &SubtitleTranslator::onError);
+
+    emit progress(0, cues.size());
+
+    // Everything at once: the service batches across all of it
+    for (int i = 0; i < sentences_.size() && !failed_; ++i) {
+        if (sentences_[i].text.isEmpty()) {
+            complete(i, {QString("")});
+            continue;
+        }
+        // Alignments tell which words of the translation go to which cue
+        int id = translator_->enqueue(sentences_[i].text, false, MarianInterface::Alignments);
+        if (id < 0) {
+            onError(tr("No translation model loaded"));
+            break;
+        }
+        inFlight_.insert(id, i);
+    }
+
+    if (!inFlight_.isEmpty() && !failed_ && !cancelled_)
+        loop.exec();
+
+    for (auto &connection : connections)
+        disconnect(connection);
+    loop_ = nullptr;
+
+    if (failed_ || cancelled_) {
+        translator_->cancelBatch();
+        return {};
+    }
+    return result_;
+}
+
+void SubtitleTranslator::cancel() {
+    cancelled_ = true;
+    // Might be called from another thread, so let our own thread stop the loop
+    QMetaObject::invokeMethod(this, [this]() { finish(); }, Qt::QueuedConnection);
+}
+
+void SubtitleTranslator::onTranslationReady(int id, Translation translation) {
+    auto it = inFlight_.find(id);
+    if (it == inFlight_.end())
+        return;
+
+    int sentence = it.value();
+    inFlight_.erase(it);
+    complete(sentence, distribute(sentences_[sentence], translation));
+
+    if (inFlight_.isEmpty())
+        finish();
+}
+
+void SubtitleTranslator::complete(int sentence, const QStringList &pieces) {
+    const Sentence &done = sentences_[sentence];
+    for (int c = 0; c < pieces.size(); ++c)
+        result_[done.firstCue + c] = pieces[c];
+    cuesDone_ += done.cueBegin.size();
+    emit progress(cuesDone_, result_.size());
+}
+
+void SubtitleTranslator::onError(QString message) {
+    qWarning() << "SubtitleTranslator:" << message;
+    failed_ = true;
+    emit error(message);
+    finish();
+}
+
+void SubtitleTranslator::finish() {
+    if (loop_)
+        loop_->quit();
+}
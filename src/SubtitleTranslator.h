@@ -0,0 +1,77 @@
+#ifndef SUBTITLETRANSLATOR_H
+#define SUBTITLETRANSLATOR_H
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+#include <atomic>
+#include "Translation.h"
+
+class MarianInterface;
+class QEventLoop;
+
+/**
+ * Subtitle mode. Cues are short and often break a sentence in two or three,
+ * so translating cue by cue translates fragments, while translating the file
+ * as running text loses track of which words belong to which cue. Instead,
+ * consecutive cues are joined into sentences, all sentences are handed to
+ * MarianInterface::enqueue() at once so the service can batch them, and each
+ * translated sentence is split over its cues again following the word
+ * alignments that come with the translation. Timings never change.
+ */
+class SubtitleTranslator : public QObject {
+    Q_OBJECT
+public:
+    struct Sentence {
+        QString text;          // Texts of its cues, joined by spaces
+        int firstCue;
+        QVector<int> cueBegin; // Where the text of each cue starts in `text`
+    };
+
+    // Most cues joined into one sentence, so a file without punctuation
+    // isn't translated as a single sentence.
+    static constexpr int MAX_SENTENCE_CUES = 4;
+
+    explicit SubtitleTranslator(MarianInterface *translator, QObject *parent = nullptr);
+
+    // Groups consecutive cues into sentences: a sentence ends with a cue that
+    // ends in sentence-final punctuation. Empty cues are a sentence by themselves.
+    static QVector<Sentence> sentences(const QStringList &cues);
+
+    // `translation` of `sentence` split in one (possibly empty) piece per cue.
+    // Every translated word goes to the cue whose source words it is aligned
+    // with most; the pieces stay in order. Without alignments the
+    // translation is split in proportion to the length of the cues.
+    static QStringList distribute(const Sentence &sentence, const Translation &translation);
+
+    // Translations of `cues`, one per cue. Blocks (running a local event
+    // loop) until done. Returns an empty list on error or cancel().
+    QStringList translate(const QStringList &cues);
+
+    // Safe to call from any thread.
+    void cancel();
+
+signals:
+    void progress(int completed, int total); // In cues
+    void error(QString message);
+
+private slots:
+    void onTranslationReady(int id, Translation translation);
+    void onError(QString message);
+
+private:
+    void complete(int sentence, const QStringList &pieces);
+    void finish();
+
+    MarianInterface *translator_;
+    QVector<Sentence> sentences_;
+    QStringList result_;
+    QHash<int, int> inFlight_; // MarianInterface id -> sentence
+    int cuesDone_;
+    bool failed_;
+    std::atomic<bool> cancelled_;
+    QEventLoop *loop_;
+};
+
+#endif // SUBTITLETRANSLATOR_H
@@ -1,5 +1,7 @@
 #include "Translation.h"
 #include "3rd_party/bergamot-translator/src/translator/response.h"
+#include <algorithm>
+#include <cmath>
 
 namespace {
 
@@ -157,3 +159,15 @@ QVector<WordAlignment> Translation::alignments(Direction direction, int sourcePo
 
     return alignments;
 }
+
+QVector<float> Translation::sentenceConfidences() const {
+    QVector<float> confidences;
+    if (!response_)
+        return confidences;
+
+    // Models without a quality estimation model score a sentence by the mean
+    // log probability of its words; that is a probability again after exp().
+    for (auto const &quality : response_->qualityScores)
+        confidences.append(quality.sequence <= 0.0f ? std::exp(quality.sequence) : std::min(quality.sequence, 1.0f));
+    return confidences;
+}
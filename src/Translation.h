@@ -64,6 +64,13 @@ public:
      * an empty list on failure.
      */
     QVector<WordAlignment> alignments(Direction direction, int begin, int end) const;
+
+    /**
+     * How sure the model is of each sentence of the translation, between 0
+     * and 1. Empty unless quality scores were asked for (see
+     * MarianInterface::enqueue()).
+     */
+    QVector<float> sentenceConfidences() const;
 };
 
 Q_DECLARE_METATYPE(Translation)
@@ -0,0 +1,75 @@
+#include "TranslationManifest.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QDebug>
+
+namespace {
+constexpr int kManifestVersion = 1;
+}
+
+QString TranslationManifest::pathFor(const QString &outputPath) {
+    return outputPath + ".tlmanifest.json";
+}
+
+void TranslationManifest::load(const QString &path, const QString &modelId) {
+    path_ = path;
+    modelId_ = modelId;
+    models_ = QJsonObject();
+    previous_.clear();
+    recorded_.clear();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (parseError.error != QJsonParseError::NoError || doc.object().value("version").toInt() != kManifestVersion) {
+        qWarning() << "Ignoring translation manifest" << path << parseError.errorString();
+        return;
+    }
+
+    models_ = doc.object().value("models").toObject();
+    QJsonObject paragraphs = models_.value(modelId).toObject();
+    for (auto it = paragraphs.constBegin(); it != paragraphs.constEnd(); ++it)
+        previous_.insert(it.key(), it.value().toString());
+}
+
+bool TranslationManifest::contains(const QString &source) const {
+    return previous_.contains(hash(source));
+}
+
+QString TranslationManifest::translation(const QString &source) const {
+    return previous_.value(hash(source));
+}
+
+void TranslationManifest::record(const QString &source, const QString &translation) {
+    recorded_.insert(hash(source), translation);
+}
+
+bool TranslationManifest::save() const {
+    QJsonObject paragraphs;
+    for (auto it = recorded_.constBegin(); it != recorded_.constEnd(); ++it)
+        paragraphs.insert(it.key(), it.value());
+
+    QJsonObject models = models_;
+    models.insert(modelId_, paragraphs);
+
+    QJsonObject root;
+    root.insert("version", kManifestVersion);
+    root.insert("models", models);
+
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write translation manifest" << path_ << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+QString TranslationManifest::hash(const QString &source) {
+    return QString::fromLatin1(QCryptographicHash::hash(source.trimmed().toUtf8(), QCryptographicHash::Sha1).toHex());
+}
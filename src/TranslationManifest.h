@@ -0,0 +1,46 @@
+#ifndef TRANSLATIONMANIFEST_H
+#define TRANSLATIONMANIFEST_H
+
+#include <QString>
+#include <QHash>
+#include <QJsonObject>
+
+/**
+ * Sidecar file kept next to a translated document. For every model (or model
+ * plus AI refinement) it has been translated with, it maps a hash of each
+ * source paragraph to the translation of that paragraph, so a later run on an
+ * edited version of the document only has to translate what changed. The
+ * hash is a SHA-1 of the trimmed text: where a paragraph is in the document
+ * does not matter.
+ *
+ * Only paragraphs recorded during the current run are saved for the current
+ * model: paragraphs that were removed from the document are dropped.
+ */
+class TranslationManifest {
+public:
+    // Path of the manifest that belongs to `outputPath`.
+    static QString pathFor(const QString &outputPath);
+
+    // Reads `path` and selects the translations made by `modelId`. A missing
+    // or unreadable manifest is the same as an empty one.
+    void load(const QString &path, const QString &modelId);
+
+    bool contains(const QString &source) const;
+    QString translation(const QString &source) const;
+
+    // Adds a source paragraph and its translation to what save() writes.
+    void record(const QString &source, const QString &translation);
+
+    bool save() const;
+
+private:
+    static QString hash(const QString &source);
+
+    QString path_;
+    QString modelId_;
+    QJsonObject models_;                // Everything in the file, by model id
+    QHash<QString, QString> previous_;  // Hash -> translation, loaded for modelId_
+    QHash<QString, QString> recorded_;  // Hash -> translation, from this run
+};
+
+#endif // TRANSLATIONMANIFEST_H
@@ -0,0 +1,449 @@
+#include "TranslationMemory.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+// File layout: magic, version, then records of
+// [quint32 source size][quint32 target size][source UTF-8][target UTF-8],
+// all integers little endian.
+const char kMagic[4] = {'T', 'L', 'T', 'M'};
+constexpr quint32 kVersion = 1;
+constexpr qint64 kHeaderSize = 8;
+constexpr qint64 kRecordHeaderSize = 8;
+
+const char *kXmlNamespace = "http://www.w3.org/XML/1998/namespace";
+
+// Language tags match if their primary language does: en-GB is en.
+bool sameLanguage(QString a, QString b) {
+    return a.replace('_', '-').section('-', 0, 0).compare(b.replace('_', '-').section('-', 0, 0), Qt::CaseInsensitive) == 0;
+}
+
+// Text of the <seg> the reader is on, leaving it on </seg>. Inline codes
+// hold markup of the original format and are left out; the text of <hi> and
+// <sub> is kept.
+QString readSeg(QXmlStreamReader &xml) {
+    static const QStringList codes = {"bpt", "ept", "it", "ph", "ut"};
+    QString text;
+    int depth = 1;
+    while (depth > 0 && !xml.atEnd()) {
+        xml.readNext();
+        if (xml.isStartElement()) {
+            if (codes.contains(xml.name().toString()))
+                xml.skipCurrentElement();
+            else
+                depth++;
+        } else if (xml.isEndElement()) {
+            depth--;
+        } else if (xml.isCharacters()) {
+            text += xml.text();
+        }
+    }
+    return text;
+}
+
+QString tuvLanguage(const QXmlStreamReader &xml) {
+    QXmlStreamAttributes attrs = xml.attributes();
+    if (attrs.hasAttribute(kXmlNamespace, "lang"))
+        return attrs.value(kXmlNamespace, "lang").toString();
+    return attrs.value("lang").toString(); // TMX 1.1
+}
+}
+
+TranslationMemory::TranslationMemory()
+    : data_(nullptr), mappedSize_(0), validSize_(0), written_(0), size_(0) {
+}
+
+TranslationMemory::~TranslationMemory() {
+    if (data_)
+        file_.unmap(const_cast<uchar *>(data_));
+}
+
+QString TranslationMemory::pathFor(const QString &sourceLanguage, const QString &targetLanguage) {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) +
+           QString("/translation-memory/%1-%2.tm").arg(sourceLanguage, targetLanguage);
+}
+
+bool TranslationMemory::open(const QString &sourceLanguage, const QString &targetLanguage, QString *errorMessage) {
+    sourceLanguage_ = sourceLanguage;
+    targetLanguage_ = targetLanguage;
+
+    QString path = pathFor(sourceLanguage, targetLanguage);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    file_.setFileName(path);
+    if (!file_.open(QIODevice::ReadWrite)) {
+        if (errorMessage)
+            *errorMessage = QCoreApplication::translate("TranslationMemory", "Could not open translation memory %1: %2")
+                                .arg(path, file_.errorString());
+        return false;
+    }
+
+    qint64 size = file_.size();
+    if (size < kHeaderSize)
+        return true; // New memory, save() writes the header
+
+    data_ = file_.map(0, size);
+    if (!data_ || std::memcmp(data_, kMagic, sizeof(kMagic)) != 0 || qFromLittleEndian<quint32>(data_ + 4) != kVersion) {
+        if (errorMessage)
+            *errorMessage = QCoreApplication::translate("TranslationMemory", "%1 is not a translation memory of this version")
+                                .arg(path);
+        file_.close();
+        data_ = nullptr;
+        return false;
+    }
+    mappedSize_ = size;
+
+    qint64 offset = kHeaderSize;
+    while (offset + kRecordHeaderSize <= size) {
+        Record record;
+        record.sourceSize = qFromLittleEndian<quint32>(data_ + offset);
+        record.targetSize = qFromLittleEndian<quint32>(data_ + offset + 4);
+        record.offset = offset + kRecordHeaderSize;
+        record.pending = -1;
+        if (record.offset + record.sourceSize + record.targetSize > size)
+            break;
+
+        index(normalise(sourceOf(record)), record);
+        offset = record.offset + record.sourceSize + record.targetSize;
+    }
+    validSize_ = offset;
+
+    if (validSize_ < size)
+        qWarning() << "Ignoring" << size - validSize_ << "bytes at the end of damaged translation memory" << path;
+
+    return true;
+}
+
+bool TranslationMemory::isOpen() const {
+    return file_.isOpen();
+}
+
+QString TranslationMemory::sourceLanguage() const {
+    return sourceLanguage_;
+}
+
+QString TranslationMemory::targetLanguage() const {
+    return targetLanguage_;
+}
+
+int TranslationMemory::size() const {
+    return size_;
+}
+
+TranslationMemory::Match TranslationMemory::lookup(const QString &source, double fuzzyThreshold) const {
+    Match match;
+    QString normalised = normalise(source);
+    if (normalised.isEmpty())
+        return match;
+
+    int exact = find(normalised);
+    if (exact >= 0) {
+        match.source = sourceOf(records_[exact]);
+        match.target = targetOf(records_[exact]);
+        match.score = 1;
+        return match;
+    }
+
+    QVector<quint64> grams = trigramsOf(normalised.toLower());
+    if (grams.isEmpty() || fuzzyThreshold > 1)
+        return match;
+
+    // The Dice score of a record with m trigrams, s of them shared, is
+    // 2s / (n + m). As s <= min(n, m), only records with m between these
+    // bounds can reach the threshold, and they share at least minShared.
+    const int n = grams.size();
+    const double t = fuzzyThreshold;
+    const int minShared = std::max(1, static_cast<int>(std::ceil(t * n / (2 - t) - 1e-9)));
+    const int minLength = minShared;
+    const int maxLength = t > 0 ? static_cast<int>(std::floor(n * (2 - t) / t + 1e-9)) : std::numeric_limits<int>::max();
+
+    // Posting lists, rarest trigram first
+    QVector<const QVector<int> *> lists;
+    lists.reserve(n);
+    static const QVector<int> none;
+    for (quint64 gram : grams) {
+        auto it = trigrams_.constFind(gram);
+        lists.append(it == trigrams_.constEnd() ? &none : &it.value());
+    }
+    std::sort(lists.begin(), lists.end(), [](const QVector<int> *a, const QVector<int> *b) {
+        return a->size() < b->size();
+    });
+
+    // A record sharing minShared trigrams has one among any n - minShared + 1
+    // of them, so only the rarest are walked to find candidates. The common
+    // ones (" th", "de ") are only searched for the candidates.
+    const int probed = n - minShared + 1;
+    QHash<int, int> shared;
+    for (int i = 0; i < probed; ++i) {
+        for (int id : *lists[i]) {
+            int length = records_[id].trigrams;
+            if (length >= minLength && length <= maxLength)
+                shared[id]++;
+        }
+    }
+
+    int best = -1;
+    for (auto it = shared.constBegin(); it != shared.constEnd(); ++it) {
+        const int id = it.key();
+        const Record &record = records_[id];
+        const int needed = static_cast<int>(std::ceil(t * (n + record.trigrams) / 2 - 1e-9));
+
+        // Posting lists are in record order, so membership is a binary search
+        int count = it.value();
+        for (int i = probed; i < n && count + (n - i) >= needed; ++i) {
+            if (std::binary_search(lists[i]->constBegin(), lists[i]->constEnd(), id))
+                count++;
+        }
+
+        double score = 2.0 * count / (n + record.trigrams);
+        if (score >= fuzzyThreshold && score > match.score) {
+            match.score = score;
+            best = id;
+        }
+    }
+
+    if (best >= 0) {
+        match.source = sourceOf(records_[best]);
+        match.target = targetOf(records_[best]);
+    }
+    return match;
+}
+
+void TranslationMemory::add(const QString &source, const QString &target) {
+    QString trimmed = source.trimmed();
+    QString normalised = normalise(trimmed);
+    if (normalised.isEmpty())
+        return;
+
+    int existing = find(normalised);
+    if (existing >= 0 && targetOf(records_[existing]) == target)
+        return;
+
+    Record record;
+    record.offset = -1;
+    record.sourceSize = 0;
+    record.targetSize = 0;
+    record.pending = pending_.size();
+    pending_.append({trimmed, target});
+    index(normalised, record);
+}
+
+bool TranslationMemory::save(QString *errorMessage) {
+    if (written_ == pending_.size())
+        return true;
+
+    if (!file_.isOpen()) {
+        if (errorMessage)
+            *errorMessage = QCoreApplication::translate("TranslationMemory", "Translation memory is not open");
+        return false;
+    }
+
+    QByteArray out;
+    if (validSize_ < kHeaderSize) {
+        out.append(kMagic, sizeof(kMagic));
+        quint32 version = qToLittleEndian(kVersion);
+        out.append(reinterpret_cast<const char *>(&version), sizeof(version));
+        validSize_ = 0;
+    }
+
+    for (int i = written_; i < pending_.size(); ++i) {
+        QByteArray source = pending_[i].first.toUtf8();
+        QByteArray target = pending_[i].second.toUtf8();
+        quint32 sizes[2] = {qToLittleEndian<quint32>(source.size()), qToLittleEndian<quint32>(target.size())};
+        out.append(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+        out.append(source);
+        out.append(target);
+    }
+
+    // Appending never touches the mapped part. A damaged end is overwritten.
+    if (!file_.seek(validSize_) || file_.write(out) != out.size() || !file_.flush()) {
+        if (errorMessage)
+            *errorMessage = QCoreApplication::translate("TranslationMemory", "Could not write translation memory %1: %2")
+                                .arg(file_.fileName(), file_.errorString());
+        return false;
+    }
+    validSize_ += out.size();
+    if (file_.size() > validSize_)
+        file_.resize(validSize_);
+
+    written_ = pending_.size();
+    return true;
+}
+
+int TranslationMemory::importTmx(const QString &tmxPath, QString *errorMessage) {
+    QFile file(tmxPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorMessage)
+            *errorMessage = QCoreApplication::translate("TranslationMemory", "Could not open %1: %2")
+                                .arg(tmxPath, file.errorString());
+        return -1;
+    }
+
+    QXmlStreamReader xml(&file);
+    int added = 0;
+    QString language, source, target;
+
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (xml.isStartElement() && xml.name() == QLatin1String("tu")) {
+            source.clear();
+            target.clear();
+        } else if (xml.isStartElement() && xml.name() == QLatin1String("tuv")) {
+            language = tuvLanguage(xml);
+        } else if (xml.isStartElement() && xml.name() == QLatin1String("seg")) {
+            QString text = readSeg(xml);
+            if (sameLanguage(language, sourceLanguage_))
+                source = text;
+            else if (sameLanguage(language, targetLanguage_))
+                target = text;
+        } else if (xml.isEndElement() && xml.name() == QLatin1String("tu")) {
+            if (!source.trimmed().isEmpty() && !target.trimmed().isEmpty()) {
+                add(source, target);
+                added++;
+            }
+        }
+    }
+
+    if (xml.hasError()) {
+        if (errorMessage)
+            *errorMessage = QCoreApplication::translate("TranslationMemory", "Error reading %1 (line %2): %3")
+                                .arg(tmxPath).arg(xml.lineNumber()).arg(xml.errorString());
+        return -1;
+    }
+
+    return save(errorMessage) ? added : -1;
+}
+
+bool TranslationMemory::exportTmx(const QString &tmxPath, QString *errorMessage) const {
+    QSaveFile file(tmxPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (errorMessage)
+            *errorMessage = QCoreApplication::translate("TranslationMemory", "Could not write %1: %2")
+                                .arg(tmxPath, file.errorString());
+        return false;
+    }
+
+    QXmlStreamWriter xml(&file);
+    xml.setAutoFormatting(true);
+    xml.writeStartDocument();
+    xml.writeStartElement("tmx");
+    xml.writeAttribute("version", "1.4");
+
+    xml.writeEmptyElement("header");
+    xml.writeAttribute("creationtool", QCoreApplication::applicationName());
+    xml.writeAttribute("creationtoolversion", QCoreApplication::applicationVersion());
+    xml.writeAttribute("datatype", "plaintext");
+    xml.writeAttribute("segtype", "paragraph");
+    xml.writeAttribute("adminlang", "en");
+    xml.writeAttribute("srclang", sourceLanguage_);
+    xml.writeAttribute("o-tmf", "translateLocally");
+
+    xml.writeStartElement("body");
+    for (const Record &record : records_) {
+        if (record.superseded)
+            continue;
+        xml.writeStartElement("tu");
+        xml.writeStartElement("tuv");
+        xml.writeAttribute(kXmlNamespace, "lang", sourceLanguage_);
+        xml.writeTextElement("seg", sourceOf(record));
+        xml.writeEndElement();
+        xml.writeStartElement("tuv");
+        xml.writeAttribute(kXmlNamespace, "lang", targetLanguage_);
+        xml.writeTextElement("seg", targetOf(record));
+        xml.writeEndElement();
+        xml.writeEndElement();
+    }
+    xml.writeEndElement(); // body
+    xml.writeEndElement(); // tmx
+    xml.writeEndDocument();
+
+    if (!file.commit()) {
+        if (errorMessage)
+            *errorMessage = QCoreApplication::translate("TranslationMemory", "Could not write %1: %2")
+                                .arg(tmxPath, file.errorString());
+        return false;
+    }
+    return true;
+}
+
+QString TranslationMemory::normalise(const QString &source) {
+    return source.simplified();
+}
+
+QVector<quint64> TranslationMemory::trigramsOf(const QString &normalised) {
+    if (normalised.size() < 3)
+        return {};
+
+    // Padded, so the start and end of a text count as well
+    QString text = " " + normalised + " ";
+    QVector<quint64> grams;
+    grams.reserve(text.size());
+    for (int i = 0; i + 2 < text.size(); ++i) {
+        grams.append(quint64(text[i].unicode()) << 32 | quint64(text[i + 1].unicode()) << 16 | text[i + 2].unicode());
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+QString TranslationMemory::sourceOf(const Record &record) const {
+    if (record.pending >= 0)
+        return pending_[record.pending].first;
+    return QString::fromUtf8(reinterpret_cast<const char *>(data_ + record.offset), record.sourceSize);
+}
+
+QString TranslationMemory::targetOf(const Record &record) const {
+    if (record.pending >= 0)
+        return pending_[record.pending].second;
+    return QString::fromUtf8(reinterpret_cast<const char *>(data_ + record.offset + record.sourceSize), record.targetSize);
+}
+
+int TranslationMemory::find(const QString &normalised) const {
+    const size_t hash = qHash(normalised);
+    for (auto it = exact_.constFind(hash); it != exact_.constEnd() && it.key() == hash; ++it) {
+        const Record &record = records_[it.value()];
+        if (normalise(sourceOf(record)) == normalised)
+            return it.value();
+    }
+    return -1;
+}
+
+void TranslationMemory::index(const QString &normalised, Record record) {
+    const size_t hash = qHash(normalised);
+    QVector<quint64> grams = trigramsOf(normalised.toLower());
+
+    // The new record replaces the one with the same source in both indexes,
+    // so lookups never see it again. It has the same trigrams.
+    int previous = find(normalised);
+    if (previous >= 0) {
+        records_[previous].superseded = true;
+        exact_.remove(hash, previous);
+        for (quint64 gram : grams) {
+            QVector<int> &list = trigrams_[gram];
+            auto it = std::lower_bound(list.begin(), list.end(), previous);
+            if (it != list.end() && *it == previous)
+                list.erase(it);
+        }
+    } else {
+        size_++;
+    }
+
+    record.trigrams = grams.size();
+    record.superseded = false;
+
+    int id = records_.size();
+    records_.append(record);
+    exact_.insert(hash, id);
+    for (quint64 gram : grams)
+        trigrams_[gram].append(id);
+}
@@ -0,0 +1,105 @@
+#ifndef TRANSLATIONMEMORY_H
+#define TRANSLATIONMEMORY_H
+
+#include <QFile>
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+/**
+ * Translation memory shared by all documents translated from one language to
+ * another: source paragraphs and their translations, so a paragraph that was
+ * translated before (in any document) does not have to go through the model
+ * again. Paragraphs that are only similar to one in the memory are fuzzy
+ * matches: they are still translated, but reported with the closest entry.
+ *
+ * Each language pair has an append-only file in the application data
+ * directory. It is memory mapped when opened, and two indexes are built over
+ * it: one from the hash of each source to its record, for exact lookups, and
+ * one from the character trigrams of each source to the records containing
+ * them, for fuzzy lookups. A fuzzy lookup only walks the records of its
+ * rarest trigrams and checks the others for those candidates, so common
+ * trigrams don't make it visit the whole memory. Replaced entries are taken
+ * out of both indexes. Only the indexes are kept in memory; texts are
+ * decoded from the mapped file when a lookup needs them.
+ * New entries are appended by save(). Entries can be exchanged with other
+ * tools as TMX.
+ */
+class TranslationMemory {
+public:
+    struct Match {
+        QString source;
+        QString target;
+        double score = 0; // Similarity of the sources, 1 for an exact match, 0: no match
+    };
+
+    // Least similarity (Dice coefficient over character trigrams) of a fuzzy match.
+    static constexpr double DEFAULT_FUZZY_THRESHOLD = 0.75;
+
+    TranslationMemory();
+    ~TranslationMemory();
+
+    // File holding the memory for this language pair (BCP-47 tags).
+    static QString pathFor(const QString &sourceLanguage, const QString &targetLanguage);
+
+    // Opens (or starts) the memory for this language pair. A damaged end of
+    // the file, as left by a crash while saving, is ignored.
+    bool open(const QString &sourceLanguage, const QString &targetLanguage, QString *errorMessage = nullptr);
+    bool isOpen() const;
+
+    QString sourceLanguage() const;
+    QString targetLanguage() const;
+
+    // Number of distinct sources in the memory
+    int size() const;
+
+    // The entry for `source` if there is one (score 1), otherwise the most
+    // similar one scoring at least `fuzzyThreshold`. score is 0 if neither.
+    Match lookup(const QString &source, double fuzzyThreshold = DEFAULT_FUZZY_THRESHOLD) const;
+
+    // Adds or replaces the translation of `source`. Written by save().
+    void add(const QString &source, const QString &target);
+
+    bool save(QString *errorMessage = nullptr);
+
+    // Adds the translation units of `tmxPath` that have both our source and
+    // target language, and saves. Returns the number of units added, or -1.
+    int importTmx(const QString &tmxPath, QString *errorMessage = nullptr);
+
+    bool exportTmx(const QString &tmxPath, QString *errorMessage = nullptr) const;
+
+private:
+    struct Record {
+        qint64 offset;      // Of the source text in the mapped file, -1 if not saved yet
+        quint32 sourceSize; // In bytes (UTF-8)
+        quint32 targetSize;
+        int trigrams;       // Distinct trigrams of the normalised source
+        int pending;        // Index in pending_, or -1
+        bool superseded;    // A later record has the same source
+    };
+
+    static QString normalise(const QString &source);
+    static QVector<quint64> trigramsOf(const QString &normalised);
+
+    QString sourceOf(const Record &record) const;
+    QString targetOf(const Record &record) const;
+    int find(const QString &normalised) const;
+    void index(const QString &normalised, Record record);
+
+    QString sourceLanguage_;
+    QString targetLanguage_;
+    QFile file_;
+    const uchar *data_;  // Mapped file, up to mappedSize_
+    qint64 mappedSize_;
+    qint64 validSize_;   // Up to the last complete record
+
+    QVector<Record> records_;
+    QMultiHash<size_t, int> exact_;           // Hash of normalised source -> record
+    QHash<quint64, QVector<int>> trigrams_;   // Trigram -> records, in ascending order
+    QVector<QPair<QString, QString>> pending_; // Added since open(), not in the mapped file
+    int written_;        // Entries of pending_ that save() has written
+    int size_;
+};
+
+#endif // TRANSLATIONMEMORY_H
@@ -39,6 +39,9 @@ static void CLIArgumentInit(QAppType& translateLocallyApp, QCommandLineParser& p
     parser.addOption({"debug", QObject::tr("Print debug messages")});
     parser.addOption({"html", QObject::tr("Input is HTML")});
     parser.addOption({"ai-improve", QObject::tr("Improve translation using AI")});
+    parser.addOption({"tm-import", QObject::tr("Add the translations in a TMX file to the translation memory of the model's language pair."), "tmx", ""});
+    parser.addOption({"tm-export", QObject::tr("Write the translation memory of the model's language pair to a TMX file."), "tmx", ""});
+    parser.addOption({"progress-json", QObject::tr("While translating a document, write progress as one JSON object per line to a file (- for stderr)."), "file", ""});
 
     parser.process(translateLocallyApp);
 }
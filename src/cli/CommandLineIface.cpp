@@ -1,7 +1,11 @@
 #include "CommandLineIface.h"
 #include "cli/NativeMsgManager.h"
 #include "DocumentProcessor.h"
+#include "DocumentFormat.h"
+#include "DocumentTranslationEngine.h"
+#include "TranslationMemory.h"
 #include <QFile>
+#include <QJsonDocument>
 #include <QProcessEnvironment>
 #if (QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
 #include <QTextCodec>
@@ -129,9 +133,12 @@ int CommandLineIface::run(QCommandLineParser const &parser) {
 
         // Try to find our model in the list of models
         QString modelpath;
+        QString srcLang, trgLang;
         for (auto&& model : models_.getInstalledModels()) {
             if (model.shortName == model_shortname) {
                 modelpath = model.path;
+                srcLang = model.srcTags.isEmpty() ? QString() : model.srcTags.firstKey();
+                trgLang = model.trgTag;
             }
         }
         if (modelpath.isEmpty()) {
@@ -139,13 +146,34 @@ int CommandLineIface::run(QCommandLineParser const &parser) {
             return 1;
         }
 
+        // The translation memory needs no model loaded
+        if (parser.isSet("tm-import") || parser.isSet("tm-export"))
+            return exchangeTranslationMemory(srcLang, trgLang, parser.value("tm-import"), parser.value("tm-export"));
+
         // Init the translation model
         translator_->setModel(modelpath, settings_.marianSettings());
 
         QString inputPath = parser.value("i");
-        if (parser.isSet("i") && isDocumentFormat(inputPath)) {
+        // Large TXT files given an output file are streamed into it as documents;
+        // without -o they go to stdout in batches as before
+        if (parser.isSet("i") && (isDocumentFormat(inputPath, parser.isSet("o"))
+                                  || (parser.isSet("o") && DocumentProcessor::shouldStream(inputPath)))) {
             QString outputPath = parser.isSet("o") ? parser.value("o") : inputPath + ".translated";
-            processDocument(inputPath, outputPath, parser.isSet("ai-improve"));
+            if (parser.isSet("progress-json")) {
+                QString progressPath = parser.value("progress-json");
+                bool opened = false;
+                if (progressPath == "-") {
+                    opened = progressStream_.open(stderr, QIODevice::WriteOnly);
+                } else {
+                    progressStream_.setFileName(progressPath);
+                    opened = progressStream_.open(QIODevice::WriteOnly | QIODevice::Truncate);
+                }
+                if (!opened) {
+                    qCritical() << "Could not open" << progressPath << "for progress:" << progressStream_.errorString();
+                    return 1;
+                }
+            }
+            processDocument(inputPath, outputPath, srcLang, trgLang, parser.isSet("ai-improve"));
         } else {
             doTranslation(parser.isSet("html"));
         }
@@ -267,6 +295,7 @@ void CommandLineIface::downloadRemoteModel(QString modelID) {
 }
 
 void CommandLineIface::outputError(QString error) {
+    writeProgressEvent({{"event", "error"}, {"message", error}});
     qCritical().noquote() << error;
     exit(22);
 }
@@ -317,23 +346,195 @@ int CommandLineIface::listNativeMessagingClients() {
     return 0;
 }
 
+int CommandLineIface::exchangeTranslationMemory(const QString &srcLang, const QString &trgLang,
+                                                const QString &importPath, const QString &exportPath) {
+    if (srcLang.isEmpty() || trgLang.isEmpty()) {
+        qCritical() << "The model does not say which languages it translates between; it has no translation memory.";
+        return 1;
+    }
+
+    TranslationMemory memory;
+    QString errorMessage;
+    if (!memory.open(srcLang, trgLang, &errorMessage)) {
+        qCritical().noquote() << errorMessage;
+        return 1;
+    }
+
+    if (!importPath.isEmpty()) {
+        int added = memory.importTmx(importPath, &errorMessage);
+        if (added < 0) {
+            qCritical().noquote() << errorMessage;
+            return 1;
+        }
+        std::cout << "Imported " << added << " translation units into the " << srcLang.toStdString() << "-"
+                  << trgLang.toStdString() << " translation memory (" << memory.size() << " entries)" << std::endl;
+    }
+
+    if (!exportPath.isEmpty()) {
+        if (!memory.exportTmx(exportPath, &errorMessage)) {
+            qCritical().noquote() << errorMessage;
+            return 1;
+        }
+        std::cout << "Exported " << memory.size() << " entries to " << exportPath.toStdString() << std::endl;
+    }
+    return 0;
+}
+
 int CommandLineIface::updateNativeMessagingManifests() {
     NativeMsgManager manager;
     return manager.writeNativeMessagingAppManifests(settings_.nativeMessagingClients()) ? 0 : 1;
 }
 
-bool CommandLineIface::isDocumentFormat(const QString &filePath) {
+void CommandLineIface::writeProgressEvent(const QJsonObject &event) {
+    if (!progressStream_.isOpen())
+        return;
+    progressStream_.write(QJsonDocument(event).toJson(QJsonDocument::Compact) + '\n');
+    progressStream_.flush();
+}
+
+bool CommandLineIface::isDocumentFormat(const QString &filePath, bool hasOutput) {
     QFileInfo fi(filePath);
     QString suffix = fi.suffix().toLower();
-    return suffix == "docx" || suffix == "epub" || suffix == "pdf";
+    if (suffix == "docx" || suffix == "epub" || suffix == "pdf")
+        return true;
+    // Formats of the DocumentFormat handlers (HTML, subtitles...) are only translated
+    // as documents into an -o file. Without one they are translated to stdout as
+    // before, which keeps `-i page.html --html` and piped subtitles working.
+    return hasOutput && DocumentFormat::supportedSuffixes().contains(suffix);
 }
 
-void CommandLineIface::processDocument(const QString &inputPath, const QString &outputPath, bool useAI) {
+void CommandLineIface::processDocument(const QString &inputPath, const QString &outputPath,
+                                       const QString &srcLang, const QString &trgLang, bool useAI) {
     // Disconnect default signals to avoid interference
     disconnect(translator_, &MarianInterface::error, this, &CommandLineIface::outputError);
     disconnect(translator_, &MarianInterface::translationReady, this, &CommandLineIface::outputTranslation);
 
     DocumentProcessor processor(inputPath, outputPath);
+    processor.setWordBudget(settings_.documentSegmentWords());
+
+    // Subtitles: whole sentences are translated in one batch and put back
+    // in their cues, timings unchanged
+    if (DocumentProcessor::isSubtitles(inputPath)) {
+        if (useAI)
+            fprintf(stderr, "AI improvement is not available for subtitles. Skipping it.\n");
+
+        SubtitleTranslator subtitles(translator_);
+        connect(&subtitles, &SubtitleTranslator::progress, this, [this](int completed, int total) {
+            std::cout << "\rTranslated subtitle " << completed << "/" << total << "..." << std::flush;
+            writeProgressEvent({{"event", "progress"}, {"cues_done", completed}, {"cues_total", total}});
+        });
+        connect(&subtitles, &SubtitleTranslator::error, this, &CommandLineIface::outputError);
+
+        std::cout << "Processing subtitles: " << inputPath.toStdString() << std::endl;
+        bool ok = processor.translateSubtitles(subtitles);
+        std::cout << std::endl;
+        if (ok) {
+            std::cout << "Successfully saved to: " << outputPath.toStdString() << std::endl;
+            writeProgressEvent({{"event", "done"}, {"output", outputPath}});
+        } else
+            outputError("Failed to translate subtitles.");
+        return;
+    }
+
+#ifdef HAVE_POPPLER
+    // Writing a PDF needs fonts, which there are only in the GUI. Say so now
+    // rather than after the whole document has been translated.
+    if (inputPath.endsWith(".pdf", Qt::CaseInsensitive) && outputPath.endsWith(".pdf", Qt::CaseInsensitive) &&
+        !DocumentMerger::canWritePdf()) {
+        outputError("PDF output can only be written from the graphical interface. "
+                    "Use an .html output (same layout) or a .txt output instead.");
+        return;
+    }
+#endif
+
+    if (useAI && !settings_.llmEnabled()) {
+        fprintf(stderr, "AI improvement requested but no AI provider is enabled in the settings. Skipping it.\n");
+        useAI = false;
+    }
+
+    // Only translate paragraphs that changed since the last run
+    if (settings_.documentReuseTranslations()) {
+        processor.enableManifest(translator_->model(),
+            useAI ? settings_.llmProvider() + "/" + settings_.llmModel() : QString());
+    }
+
+    // And paragraphs translated before in any document
+    if (settings_.documentTranslationMemory() && !srcLang.isEmpty() && !trgLang.isEmpty())
+        processor.enableTranslationMemory(srcLang, trgLang, settings_.documentFuzzyMatchPercent() / 100.0);
+
+    // Machine translate segments concurrently and, if requested, let the LLM
+    // improve each one while the following ones are still being translated.
+    DocumentTranslationEngine engine(translator_);
+    engine.setRefiner(useAI ? llm_.data() : nullptr);
+    // Progress in words with speed and time left. Totals are unknown (-1)
+    // while a document is streamed.
+    int segmentsDone = 0;
+    int segmentsTotal = -1;
+    connect(&engine, &DocumentTranslationEngine::progress, this, [&](int completed, int total) {
+        segmentsDone = completed;
+        segmentsTotal = total;
+    });
+    connect(&engine, &DocumentTranslationEngine::wordProgress, this,
+        [&](qint64 completed, qint64 total, double wordsPerSecond, qint64 etaSeconds) {
+            std::cout << "\rTranslated " << completed;
+            if (total >= 0)
+                std::cout << "/" << total;
+            std::cout << " words (" << qRound(wordsPerSecond) << " words/s";
+            if (etaSeconds >= 0)
+                std::cout << ", " << ProgressMeter::formatDuration(etaSeconds).toStdString() << " left";
+            std::cout << ")...   " << std::flush;
+
+            QJsonObject event{
+                {"event", "progress"},
+                {"words_done", completed},
+                {"words_total", total},
+                {"words_per_second", wordsPerSecond},
+                {"eta_seconds", etaSeconds},
+                {"segments_done", segmentsDone},
+                {"segments_total", segmentsTotal}
+            };
+            if (useAI) {
+                event["llm_chunks_cached"] = llm_->cachedChunks();
+                event["llm_chunks_refined"] = llm_->refinedChunks();
+                event["llm_sentences_skipped"] = llm_->skippedSentences();
+            }
+            writeProgressEvent(event);
+        });
+    connect(&engine, &DocumentTranslationEngine::refinementProgress, this, [this](int segment, int total, int, int) {
+        std::cout << "\rImproving segment " << segment;
+        if (total >= 0)
+            std::cout << "/" << total;
+        std::cout << " with AI";
+        if (llm_->cachedChunks() > 0)
+            std::cout << " (" << llm_->cachedChunks() << " chunks from cache)";
+        if (llm_->skippedSentences() > 0)
+            std::cout << " (" << llm_->skippedSentences() << " sentences kept as translated)";
+        std::cout << "..." << std::flush;
+    });
+    connect(&engine, &DocumentTranslationEngine::refinementError, this, [](QString msg) {
+        fprintf(stderr, "AI Error: %s\n", msg.toStdString().c_str());
+    });
+    connect(&engine, &DocumentTranslationEngine::error, this, &CommandLineIface::outputError);
+
+    // Large TXT and EPUB files, and PDFs, are translated and written while they are read
+    if (DocumentProcessor::shouldStream(inputPath)) {
+        std::cout << "Streaming document: " << inputPath.toStdString() << std::endl;
+        bool ok = processor.translateStreaming(engine);
+        std::cout << std::endl;
+        if (processor.reusedParagraphs() > 0)
+            std::cout << "Reused " << processor.reusedParagraphs() << " translated paragraphs" << std::endl;
+        for (auto &&fuzzy : processor.fuzzyMatches()) {
+            std::cout << "Fuzzy match (" << qRound(fuzzy.match.score * 100) << "%) in segment " << fuzzy.segment
+                      << ", paragraph " << fuzzy.paragraph << ": " << fuzzy.match.source.left(60).toStdString() << std::endl;
+        }
+        if (ok) {
+            std::cout << "Successfully saved to: " << outputPath.toStdString() << std::endl;
+            writeProgressEvent({{"event", "done"}, {"output", outputPath}});
+        } else {
+            outputError("Failed to translate document.");
+        }
+        return;
+    }
 
     // Split the document
     if (!processor.open()) {
@@ -342,79 +543,29 @@ void CommandLineIface::processDocument(const QString &inputPath, const QString &
     }
 
     // Get segments
-    QList<DocumentSplitter::Segment> segments = processor.getSegments();
-    if (segments.isEmpty()) {
+    if (processor.getSegments().isEmpty()) {
         outputError("No text found in document or document empty.");
         return;
     }
+    QList<DocumentSplitter::Segment> segments = processor.getPendingSegments();
+
+    std::cout << "Processing document: " << inputPath.toStdString() << " (" << segments.size() << " segments to translate)" << std::endl;
+    if (processor.reusedParagraphs() > 0)
+        std::cout << "Reused " << processor.reusedParagraphs() << " translated paragraphs" << std::endl;
 
-    std::cout << "Processing document: " << inputPath.toStdString() << " (" << segments.size() << " segments)" << std::endl;
+    // Fuzzy matches are translated anyway, but worth a look afterwards
+    for (auto &&fuzzy : processor.fuzzyMatches()) {
+        std::cout << "Fuzzy match (" << qRound(fuzzy.match.score * 100) << "%) in segment " << fuzzy.segment
+                  << ", paragraph " << fuzzy.paragraph << ": " << fuzzy.match.source.left(60).toStdString() << std::endl;
+    }
     std::cout << "Starting translation..." << std::endl;
 
+    // Nothing to translate if the whole document came from the manifest
     QList<DocumentSplitter::Segment> translatedSegments;
-    int progress = 0;
-    bool translationReceived = false;
     bool errorOccurred = false;
-
-    for (const auto &seg : segments) {
-        if (errorOccurred) break;
-        progress++;
-        std::cout << "\rTranslating segment " << progress << "/" << segments.size() << "..." << std::flush;
-
-        // Setup a local event loop for this segment
-        translationReceived = false;
-
-        // Connect unique signals for this translation
-        QMetaObject::Connection successConn = connect(translator_, &MarianInterface::translationReady,
-            [&](Translation t) {
-                DocumentSplitter::Segment transSeg = seg;
-                transSeg.text = t.translation();
-
-                if (useAI) {
-                     QEventLoop aiLoop;
-
-                     QMetaObject::Connection aiConn = connect(llm_, &LLMInterface::verificationReady,
-                         [&](QString suggestion) {
-                             if (!suggestion.isEmpty()) {
-                                 transSeg.text = suggestion;
-                             }
-                             aiLoop.exit();
-                         });
-
-                     QMetaObject::Connection aiErr = connect(llm_, &LLMInterface::error,
-                         [&](QString msg) {
-                              fprintf(stderr, "AI Error: %s\n", msg.toStdString().c_str());
-                              aiLoop.exit();
-                         });
-
-                     llm_->verifyTranslation(seg.text, t.translation());
-                     aiLoop.exec();
-
-                     disconnect(aiConn);
-                     disconnect(aiErr);
-                }
-
-                translatedSegments.append(transSeg);
-                translationReceived = true;
-                eventLoop_.exit();
-            });
-
-        QMetaObject::Connection errorConn = connect(translator_, &MarianInterface::error,
-            [&](QString msg) {
-                outputError(msg);
-                errorOccurred = true;
-                eventLoop_.exit();
-            });
-
-        translator_->translate(seg.text, false);
-
-        // Wait for result
-        if (!translationReceived && !errorOccurred) {
-            eventLoop_.exec();
-        }
-
-        disconnect(successConn);
-        disconnect(errorConn);
+    if (!segments.isEmpty()) {
+        translatedSegments = engine.translate(segments);
+        errorOccurred = translatedSegments.isEmpty();
     }
 
     std::cout << std::endl << "Translation complete. Reassembling document..." << std::endl;
@@ -423,6 +574,7 @@ void CommandLineIface::processDocument(const QString &inputPath, const QString &
         processor.setTranslatedSegments(translatedSegments);
         if (processor.save()) {
             std::cout << "Successfully saved to: " << outputPath.toStdString() << std::endl;
+            writeProgressEvent({{"event", "done"}, {"output", outputPath}});
         } else {
             outputError("Failed to save translated document.");
         }
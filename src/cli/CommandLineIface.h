@@ -6,6 +6,7 @@
 #include <QTextStream>
 #include <QCommandLineParser>
 #include <QEventLoop>
+#include <QJsonObject>
 #include "inventory/ModelManager.h"
 #include "settings/Settings.h"
 #include "MarianInterface.h"
@@ -34,6 +35,9 @@ private:
     QTextStream instream_;
     QTextStream outstream_;
 
+    // --progress-json: one JSON object per line for job schedulers
+    QFile progressStream_;
+
     static const int constexpr prefetchLines = 320;
 
     // Functions
@@ -43,14 +47,20 @@ private:
     inline QString &fetchData(QString &);
 
     // Document processing
-    void processDocument(const QString &inputPath, const QString &outputPath, bool useAI = false);
-    bool isDocumentFormat(const QString &filePath);
+    void processDocument(const QString &inputPath, const QString &outputPath,
+                         const QString &srcLang, const QString &trgLang, bool useAI = false);
+    bool isDocumentFormat(const QString &filePath, bool hasOutput);
+    void writeProgressEvent(const QJsonObject &event);
 
     int allowNativeMessagingClient(QStringList ids);
     int removeNativeMessagingClient(QStringList ids);
     int listNativeMessagingClients();
     int updateNativeMessagingManifests();
 
+    // --tm-import and --tm-export: TMX in and out of the translation memory
+    int exchangeTranslationMemory(const QString &srcLang, const QString &trgLang,
+                                  const QString &importPath, const QString &exportPath);
+
 public:
     explicit CommandLineIface(QObject * parent = nullptr);
     int run(QCommandLineParser const &);
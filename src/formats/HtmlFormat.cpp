@@ -0,0 +1,209 @@
+#include "HtmlFormat.h"
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
+namespace {
+
+bool isBlock(const QString &name) {
+    static const QStringList blocks = {
+        "p", "h1", "h2", "h3", "h4", "h5", "h6", "li", "dt", "dd", "td", "th", "caption", "figcaption"
+    };
+    return blocks.contains(name);
+}
+
+// Elements whose start tag ends an open block, besides blocks themselves
+bool endsBlock(const QString &name) {
+    static const QStringList containers = {
+        "html", "body", "div", "section", "article", "aside", "header", "footer", "nav", "main", "ul", "ol",
+        "dl", "table", "thead", "tbody", "tfoot", "tr", "blockquote", "figure", "form", "hr", "pre"
+    };
+    return isBlock(name) || containers.contains(name);
+}
+
+bool isVoid(const QString &name) {
+    static const QStringList voids = {
+        "area", "base", "br", "col", "embed", "hr", "img", "input", "link", "meta", "source", "track", "wbr"
+    };
+    return voids.contains(name);
+}
+
+// Index of the '>' that closes the tag starting at `lt`, skipping quoted
+// attribute values. -1 if there is none.
+int tagEnd(const QString &html, int lt) {
+    QChar quote;
+    for (int i = lt + 1; i < html.size(); ++i) {
+        QChar c = html[i];
+        if (!quote.isNull()) {
+            if (c == quote)
+                quote = QChar();
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '>') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool readHtml(const QString &path, QString &html, QString *errorMessage) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return false;
+    }
+    html = QString::fromUtf8(file.readAll());
+    return true;
+}
+
+} // namespace
+
+QVector<HtmlFormat::Block> HtmlFormat::findBlocks(const QString &html) {
+    QVector<Block> blocks;
+
+    bool inBlock = false;
+    bool hasText = false;
+    QString blockName;
+    QStringList inlineOpen; // Elements opened inside the current block
+    Block block = {0, 0};
+
+    auto closeBlock = [&](int end) {
+        inBlock = false;
+        block.end = end;
+        if (hasText && block.end > block.begin)
+            blocks.append(block);
+    };
+
+    int pos = 0;
+    while (pos < html.size()) {
+        int lt = html.indexOf('<', pos);
+        int textEnd = lt < 0 ? html.size() : lt;
+        if (inBlock && !hasText) {
+            for (int i = pos; i < textEnd && !hasText; ++i)
+                hasText = !html[i].isSpace();
+        }
+        if (lt < 0)
+            break;
+
+        // Comments, doctype and processing instructions
+        if (QStringView(html).mid(lt, 4) == QLatin1String("<!--")) {
+            int end = html.indexOf("-->", lt + 4);
+            pos = end < 0 ? html.size() : end + 3;
+            continue;
+        }
+        if (lt + 1 < html.size() && (html[lt + 1] == '!' || html[lt + 1] == '?')) {
+            int end = html.indexOf('>', lt);
+            pos = end < 0 ? html.size() : end + 1;
+            continue;
+        }
+
+        bool closing = lt + 1 < html.size() && html[lt + 1] == '/';
+        int nameStart = lt + (closing ? 2 : 1);
+        int nameEnd = nameStart;
+        while (nameEnd < html.size() && (html[nameEnd].isLetterOrNumber() || html[nameEnd] == '-'))
+            nameEnd++;
+        int gt = tagEnd(html, lt);
+        if (nameEnd == nameStart || gt < 0) {
+            // A '<' that doesn't start a tag is text
+            hasText = hasText || inBlock;
+            pos = lt + 1;
+            continue;
+        }
+        QString name = html.mid(nameStart, nameEnd - nameStart).toLower();
+        bool selfClosing = html[gt - 1] == '/';
+
+        // Script and style content is not text, and may contain '<'
+        if (!closing && (name == "script" || name == "style")) {
+            int end = html.indexOf("</" + name, gt, Qt::CaseInsensitive);
+            end = end < 0 ? -1 : html.indexOf('>', end);
+            pos = end < 0 ? html.size() : end + 1;
+            continue;
+        }
+
+        if (inBlock) {
+            if (closing) {
+                int open = inlineOpen.lastIndexOf(name);
+                if (open >= 0) {
+                    inlineOpen.erase(inlineOpen.begin() + open, inlineOpen.end());
+                } else {
+                    // Our end tag, or that of an element around the block
+                    closeBlock(lt);
+                    if (name != blockName)
+                        continue; // Look at the tag again outside of the block
+                }
+            } else if (endsBlock(name)) {
+                closeBlock(lt);
+                continue;
+            } else if (!selfClosing && !isVoid(name)) {
+                inlineOpen.append(name);
+            }
+        } else if (!closing && isBlock(name) && !selfClosing) {
+            inBlock = true;
+            hasText = false;
+            blockName = name;
+            inlineOpen.clear();
+            block.begin = gt + 1;
+        }
+        pos = gt + 1;
+    }
+
+    if (inBlock)
+        closeBlock(html.size());
+
+    return blocks;
+}
+
+QString HtmlFormat::name() const {
+    return "HTML";
+}
+
+QStringList HtmlFormat::suffixes() const {
+    return {"html", "htm"};
+}
+
+bool HtmlFormat::html() const {
+    return true;
+}
+
+bool HtmlFormat::extract(const QString &path, const UnitCallback &unit, QString *errorMessage) const {
+    QString html;
+    if (!readHtml(path, html, errorMessage))
+        return false;
+
+    // Whitespace is collapsed as a browser would
+    for (const Block &block : findBlocks(html))
+        unit(html.mid(block.begin, block.end - block.begin).simplified());
+    return true;
+}
+
+bool HtmlFormat::rewrite(const QString &path, const QVector<QString> &translations, const QString &outputPath,
+                         QString *errorMessage) const {
+    QString html;
+    if (!readHtml(path, html, errorMessage))
+        return false;
+
+    QString result;
+    result.reserve(html.size() + html.size() / 4);
+
+    int copied = 0;
+    const QVector<Block> blocks = findBlocks(html);
+    for (int id = 0; id < blocks.size() && id < translations.size(); ++id) {
+        if (translations[id].isNull())
+            continue; // Not translated, keep the original
+
+        result.append(html.constData() + copied, blocks[id].begin - copied);
+        QString translated = translations[id].trimmed();
+        result += translated.isEmpty() ? QString(" ") : translated; // Keep structure
+        copied = blocks[id].end;
+    }
+    result.append(html.constData() + copied, html.size() - copied);
+
+    QSaveFile file(outputPath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(result.toUtf8()) < 0 || !file.commit()) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef HTMLFORMAT_H
+#define HTMLFORMAT_H
+
+#include "DocumentFormat.h"
+
+/**
+ * HTML pages. Unlike the XHTML of EPUB these need not be well-formed XML
+ * (unclosed <p> and <li>, <br> without a slash...), so blocks are found by a
+ * tolerant scan of the tags rather than by QXmlStreamReader. A unit is the
+ * inner HTML of a block element (paragraph, heading, list item, table cell...)
+ * and is translated in HTML mode. The file is read as UTF-8.
+ */
+class HtmlFormat : public DocumentFormat {
+public:
+    // Content of a block element: the characters between its start tag and
+    // its end tag, or whatever implicitly ends it.
+    struct Block {
+        int begin;
+        int end;
+    };
+
+    // Blocks of `html` that contain text, in document order. A block element
+    // inside another block ends the outer one.
+    static QVector<Block> findBlocks(const QString &html);
+
+    QString name() const override;
+    QStringList suffixes() const override;
+    bool html() const override;
+    bool extract(const QString &path, const UnitCallback &unit, QString *errorMessage = nullptr) const override;
+    bool rewrite(const QString &path, const QVector<QString> &translations, const QString &outputPath,
+                 QString *errorMessage = nullptr) const override;
+};
+
+#endif // HTMLFORMAT_H
@@ -0,0 +1,289 @@
+#include "PackageFormat.h"
+#include "ArchiveEntries.h"
+#include <QDebug>
+#include <QFile>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+namespace {
+
+/**
+ * Collects the units of one XML part as it is fed, a block at a time. Units
+ * nested in another unit (a frame inside an ODT paragraph) count in the
+ * order they start, same as in rewritePart(), so they are reported once the
+ * outermost unit ends.
+ */
+class UnitReader {
+public:
+    UnitReader(const PackageFormat::Rules &rules, const DocumentFormat::UnitCallback &unit)
+        : rules_(rules), unit_(unit), textDepth_(0) {
+        xml_.setNamespaceProcessing(false);
+    }
+
+    void addData(const QByteArray &data) {
+        xml_.addData(data);
+
+        // Running out of data is expected until the last block
+        while (!xml_.atEnd()) {
+            xml_.readNext();
+            if (xml_.isStartElement()) {
+                QString name = xml_.qualifiedName().toString();
+                if (rules_.units.contains(name)) {
+                    open_.append(pending_.size());
+                    pending_.append(QString());
+                } else if (!open_.isEmpty()) {
+                    if (rules_.text.contains(name))
+                        textDepth_++;
+                    else if (rules_.spaces.contains(name))
+                        pending_[open_.last()] += ' ';
+                }
+            } else if (xml_.isEndElement()) {
+                QString name = xml_.qualifiedName().toString();
+                if (rules_.units.contains(name) && !open_.isEmpty()) {
+                    open_.removeLast();
+                    if (open_.isEmpty())
+                        flush();
+                } else if (rules_.text.contains(name) && textDepth_ > 0) {
+                    textDepth_--;
+                }
+            } else if (xml_.isCharacters() && !open_.isEmpty() && (rules_.text.isEmpty() || textDepth_ > 0)) {
+                pending_[open_.last()] += xml_.text();
+            }
+        }
+    }
+
+    bool hasError() const {
+        return xml_.hasError() && xml_.error() != QXmlStreamReader::PrematureEndOfDocumentError;
+    }
+
+    QString errorString() const {
+        return xml_.errorString();
+    }
+
+private:
+    void flush() {
+        // Units are single lines; the line breaks in them are just spaces
+        for (const QString &text : pending_)
+            unit_(text.simplified());
+        pending_.clear();
+    }
+
+    const PackageFormat::Rules &rules_;
+    const DocumentFormat::UnitCallback &unit_;
+    QXmlStreamReader xml_;
+    QStringList pending_; // Units of the current outermost unit, in start order
+    QVector<int> open_;   // Indexes in pending_ of the units open now
+    int textDepth_;
+};
+
+} // namespace
+
+PackageFormat::PackageFormat(const QString &name, const QStringList &suffixes, const QString &parts, const Rules &rules)
+    : name_(name), suffixes_(suffixes), parts_(parts), rules_(rules) {
+}
+
+std::unique_ptr<DocumentFormat> PackageFormat::odt() {
+    return std::make_unique<PackageFormat>("ODT", QStringList{"odt"}, "^content\\.xml$",
+        Rules{{"text:p", "text:h"}, {}, {"text:s", "text:tab", "text:line-break"}});
+}
+
+std::unique_ptr<DocumentFormat> PackageFormat::pptx() {
+    return std::make_unique<PackageFormat>("PPTX", QStringList{"pptx"},
+        "^ppt/(slides/slide|notesSlides/notesSlide)\\d+\\.xml$",
+        Rules{{"a:p"}, {"a:t"}, {"a:br"}});
+}
+
+std::unique_ptr<DocumentFormat> PackageFormat::xlsx() {
+    return std::make_unique<PackageFormat>("XLSX", QStringList{"xlsx"}, "^xl/sharedStrings\\.xml$",
+        Rules{{"si"}, {"t"}, {}});
+}
+
+QString PackageFormat::name() const {
+    return name_;
+}
+
+QStringList PackageFormat::suffixes() const {
+    return suffixes_;
+}
+
+bool PackageFormat::isPart(const QString &entryName) const {
+    return parts_.match(entryName).hasMatch();
+}
+
+bool PackageFormat::extract(const QString &path, const UnitCallback &unit, QString *errorMessage) const {
+    struct archive *a = archive_read_new();
+    archive_read_support_format_all(a);
+    archive_read_support_filter_all(a);
+
+    if (archive_read_open_filename(a, path.toUtf8().constData(), 10240) != ARCHIVE_OK) {
+        if (errorMessage)
+            *errorMessage = QString::fromUtf8(archive_error_string(a));
+        archive_read_free(a);
+        return false;
+    }
+
+    QString failure;
+    bool foundPart = false;
+    struct archive_entry *entry;
+    int r;
+    while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+        QString entryName = QString::fromUtf8(archive_entry_pathname(entry));
+        if (!isPart(entryName))
+            continue;
+
+        // Parsed while it is decompressed, as DOCX is
+        foundPart = true;
+        UnitReader reader(rules_, unit);
+        const void *block;
+        size_t size;
+        la_int64_t offset;
+        while ((r = archive_read_data_block(a, &block, &size, &offset)) == ARCHIVE_OK && !reader.hasError())
+            reader.addData(QByteArray::fromRawData(static_cast<const char *>(block), static_cast<int>(size)));
+
+        if (reader.hasError()) {
+            failure = QString("%1: %2").arg(entryName, reader.errorString());
+            break;
+        }
+        if (r != ARCHIVE_EOF) {
+            failure = QString("%1: %2").arg(entryName, QString::fromUtf8(archive_error_string(a)));
+            break;
+        }
+    }
+
+    if (failure.isEmpty() && r != ARCHIVE_EOF)
+        failure = QString::fromUtf8(archive_error_string(a));
+    if (failure.isEmpty() && !foundPart)
+        failure = QString("no text found in %1 package").arg(name_);
+    archive_read_free(a);
+
+    if (!failure.isEmpty()) {
+        if (errorMessage)
+            *errorMessage = failure;
+        return false;
+    }
+    return true;
+}
+
+QByteArray PackageFormat::rewritePart(const QByteArray &original, const QVector<QString> &translations, int &nextId) const {
+    // Every token is copied from reader to writer, except the text of
+    // translated units. No namespace processing, so prefixes and namespace
+    // declarations are copied exactly as written.
+    QByteArray result;
+    result.reserve(original.size());
+
+    QXmlStreamReader xml(original);
+    xml.setNamespaceProcessing(false);
+    QXmlStreamWriter out(&result);
+
+    struct OpenUnit {
+        QString translation; // Null: keep the original
+        bool written;
+    };
+    QVector<OpenUnit> open;
+    int textDepth = 0;
+
+    while (!xml.atEnd()) {
+        xml.readNext();
+
+        if (xml.isStartElement()) {
+            QString name = xml.qualifiedName().toString();
+            if (rules_.units.contains(name)) {
+                int id = nextId++;
+                open.append({id < translations.size() ? translations[id] : QString(), false});
+            } else if (!open.isEmpty() && !open.last().translation.isNull() && rules_.spaces.contains(name)) {
+                xml.skipCurrentElement(); // Part of the text that was translated
+                continue;
+            } else if (!open.isEmpty() && rules_.text.contains(name)) {
+                textDepth++;
+            }
+            // Not writeCurrentToken(): without namespace processing that
+            // would drop the prefix from the element name.
+            out.writeStartElement(name);
+            out.writeAttributes(xml.attributes());
+        } else if (xml.isEndElement()) {
+            out.writeEndElement();
+            if (rules_.units.contains(xml.qualifiedName().toString()) && !open.isEmpty())
+                open.removeLast();
+            else if (rules_.text.contains(xml.qualifiedName().toString()) && textDepth > 0)
+                textDepth--;
+        } else if (xml.isCharacters() && !open.isEmpty() && !open.last().translation.isNull() &&
+                   (rules_.text.isEmpty() || textDepth > 0)) {
+            if (!open.last().written && !xml.isWhitespace()) {
+                out.writeCharacters(open.last().translation);
+                open.last().written = true;
+            }
+        } else if (!xml.hasError()) {
+            out.writeCurrentToken(xml);
+        }
+    }
+
+    if (xml.hasError()) {
+        qWarning() << name_ << "merge: error parsing XML, keeping the original:" << xml.errorString();
+        return original;
+    }
+    return result;
+}
+
+bool PackageFormat::rewrite(const QString &path, const QVector<QString> &translations, const QString &outputPath,
+                            QString *errorMessage) const {
+    struct archive *reader = archive_read_new();
+    struct archive *writer = archive_write_new();
+    struct archive_entry *entry;
+
+    archive_read_support_format_all(reader);
+    archive_read_support_filter_all(reader);
+    archive_write_set_format_zip(writer);
+
+    if (archive_read_open_filename(reader, path.toUtf8().constData(), 10240) != ARCHIVE_OK ||
+        archive_write_open_filename(writer, outputPath.toUtf8().constData()) != ARCHIVE_OK) {
+        if (errorMessage)
+            *errorMessage = translateLocally::archiveError(reader, writer);
+        archive_read_free(reader);
+        archive_write_free(writer);
+        return false;
+    }
+
+    // Parts come in the same order as on extraction, so ids carry on from
+    // one part to the next.
+    int nextId = 0;
+    QString failure;
+    int r;
+    while ((r = archive_read_next_header(reader, &entry)) == ARCHIVE_OK) {
+        QString entryName = QString::fromUtf8(archive_entry_pathname(entry));
+
+        if (isPart(entryName)) {
+            QByteArray content;
+            if (!translateLocally::readEntryData(reader, content) ||
+                !translateLocally::writeEntry(writer, entry, rewritePart(content, translations, nextId))) {
+                failure = entryName;
+                break;
+            }
+        } else if (!translateLocally::copyEntry(reader, writer, entry)) {
+            failure = entryName;
+            break;
+        }
+    }
+
+    if (failure.isEmpty() && r != ARCHIVE_EOF)
+        failure = path;
+
+    if (!failure.isEmpty()) {
+        if (errorMessage)
+            *errorMessage = QString("%1: %2").arg(failure, translateLocally::archiveError(reader, writer));
+        archive_read_free(reader);
+        archive_write_free(writer);
+        QFile::remove(outputPath);
+        return false;
+    }
+
+    archive_read_free(reader);
+    archive_write_close(writer);
+    archive_write_free(writer);
+
+    if (nextId < translations.size())
+        qWarning() << name_ << "merge:" << translations.size() - nextId << "translated units left unused";
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef PACKAGEFORMAT_H
+#define PACKAGEFORMAT_H
+
+#include "DocumentFormat.h"
+#include <QRegularExpression>
+#include <memory>
+
+/**
+ * ZIP package of XML parts: ODT, PPTX and XLSX. The parts whose name matches
+ * `parts` are parsed with QXmlStreamReader while they are decompressed; every
+ * `units` element in them is a unit, made of the characters of its `text`
+ * elements (or all its characters if there are none). Parts are handled in
+ * archive order, on extraction as well as when rewriting.
+ *
+ * When rewriting, the first non-blank text of a translated unit gets the
+ * translation and its other text is removed, as for DOCX: the unit takes the
+ * formatting of its first run.
+ */
+class PackageFormat : public DocumentFormat {
+public:
+    struct Rules {
+        QStringList units;  // Qualified names of the unit elements
+        QStringList text;   // Elements holding the text of a unit; empty: any
+        QStringList spaces; // Empty elements that stand for a space (tabs, line breaks...)
+    };
+
+    PackageFormat(const QString &name, const QStringList &suffixes, const QString &parts, const Rules &rules);
+
+    // content.xml paragraphs and headings
+    static std::unique_ptr<DocumentFormat> odt();
+    // Paragraphs of slides and speaker notes
+    static std::unique_ptr<DocumentFormat> pptx();
+    // Shared strings. Inline strings of the sheets themselves are not translated.
+    static std::unique_ptr<DocumentFormat> xlsx();
+
+    QString name() const override;
+    QStringList suffixes() const override;
+    bool extract(const QString &path, const UnitCallback &unit, QString *errorMessage = nullptr) const override;
+    bool rewrite(const QString &path, const QVector<QString> &translations, const QString &outputPath,
+                 QString *errorMessage = nullptr) const override;
+
+private:
+    bool isPart(const QString &entryName) const;
+    QByteArray rewritePart(const QByteArray &xml, const QVector<QString> &translations, int &nextId) const;
+
+    QString name_;
+    QStringList suffixes_;
+    QRegularExpression parts_;
+    Rules rules_;
+};
+
+#endif // PACKAGEFORMAT_H
@@ -0,0 +1,108 @@
+#include "SubtitleFormat.h"
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+
+namespace {
+
+bool readLines(const QString &path, QStringList &lines, QString *errorMessage) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return false;
+    }
+    QString text = QString::fromUtf8(file.readAll());
+    if (text.startsWith(QChar(0xFEFF)))
+        text.remove(0, 1);
+    lines = text.split('\n');
+    return true;
+}
+
+} // namespace
+
+QVector<SubtitleFormat::Cue> SubtitleFormat::findCues(const QStringList &lines) {
+    // A cue is a timing line ("00:00:01,000 --> 00:00:02,000", maybe preceded
+    // by a number or identifier) followed by its text, up to a blank line.
+    // Blocks without a timing line (WEBVTT header, NOTE, STYLE) have no text.
+    QVector<Cue> cues;
+    int i = 0;
+    while (i < lines.size()) {
+        if (!lines[i].contains(QLatin1String("-->"))) {
+            i++;
+            continue;
+        }
+
+        Cue cue = {i + 1, 0};
+        for (i = cue.firstLine; i < lines.size() && !lines[i].trimmed().isEmpty(); ++i)
+            cue.lineCount++;
+        cues.append(cue);
+    }
+    return cues;
+}
+
+QStringList SubtitleFormat::wrap(const QString &text, int count) {
+    QStringList lines;
+    QString rest = text;
+    for (int left = count; left > 1; --left) {
+        // Break at the space closest to an even share of what's left
+        int target = rest.size() / left;
+        int before = rest.lastIndexOf(' ', target);
+        int after = rest.indexOf(' ', target);
+        int cut = before <= 0 ? after : (after < 0 || target - before <= after - target ? before : after);
+        if (cut <= 0)
+            break;
+        lines.append(rest.left(cut));
+        rest = rest.mid(cut + 1);
+    }
+    lines.append(rest);
+    return lines;
+}
+
+QString SubtitleFormat::name() const {
+    return "Subtitles";
+}
+
+QStringList SubtitleFormat::suffixes() const {
+    return {"srt", "vtt"};
+}
+
+bool SubtitleFormat::extract(const QString &path, const UnitCallback &unit, QString *errorMessage) const {
+    QStringList lines;
+    if (!readLines(path, lines, errorMessage))
+        return false;
+
+    for (const Cue &cue : findCues(lines))
+        unit(lines.mid(cue.firstLine, cue.lineCount).join(' ').simplified());
+    return true;
+}
+
+bool SubtitleFormat::rewrite(const QString &path, const QVector<QString> &translations, const QString &outputPath,
+                             QString *errorMessage) const {
+    QStringList lines;
+    if (!readLines(path, lines, errorMessage))
+        return false;
+
+    // Cue text is replaced from the last cue to the first, so the line
+    // numbers of the cues still to do stay valid.
+    const QVector<Cue> cues = findCues(lines);
+    for (int id = std::min(cues.size(), translations.size()) - 1; id >= 0; --id) {
+        const Cue &cue = cues[id];
+        if (translations[id].isNull() || cue.lineCount == 0)
+            continue; // Not translated, keep the original
+
+        QStringList wrapped = wrap(translations[id].simplified(), cue.lineCount);
+        lines.erase(lines.begin() + cue.firstLine, lines.begin() + cue.firstLine + cue.lineCount);
+        for (int i = 0; i < wrapped.size(); ++i)
+            lines.insert(cue.firstLine + i, wrapped[i]);
+    }
+
+    QSaveFile file(outputPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text) || file.write(lines.join('\n').toUtf8()) < 0 ||
+        !file.commit()) {
+        if (errorMessage)
+            *errorMessage = file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef SUBTITLEFORMAT_H
+#define SUBTITLEFORMAT_H
+
+#include "DocumentFormat.h"
+
+/**
+ * SubRip (.srt) and WebVTT (.vtt) subtitles. A unit is the text of one cue,
+ * its lines joined by spaces. Numbers, timings, cue settings and VTT header,
+ * NOTE and STYLE blocks are copied unchanged; a translated cue is wrapped to
+ * as many lines as the original had.
+ */
+class SubtitleFormat : public DocumentFormat {
+public:
+    // Lines of a cue's text: first (index into the file's lines) and count
+    struct Cue {
+        int firstLine;
+        int lineCount;
+    };
+
+    // Cues of a subtitle file split into lines, in file order
+    static QVector<Cue> findCues(const QStringList &lines);
+
+    // `text` in at most `count` lines of about the same length, broken at spaces
+    static QStringList wrap(const QString &text, int count);
+
+    QString name() const override;
+    QStringList suffixes() const override;
+    bool extract(const QString &path, const UnitCallback &unit, QString *errorMessage = nullptr) const override;
+    bool rewrite(const QString &path, const QVector<QString> &translations, const QString &outputPath,
+                 QString *errorMessage = nullptr) const override;
+};
+
+#endif // SUBTITLEFORMAT_H
@@ -548,11 +548,19 @@ void MainWindow::on_actionOpenDocument_triggered() {
     QString filePath = QFileDialog::getOpenFileName(this,
         tr("Open Document"),
         QString(),
-        tr("Documents (*.txt *.docx *.epub *.pdf);;All Files (*)"));
+        tr("Documents (*.txt *.docx *.epub *.pdf *.odt *.pptx *.xlsx *.html *.htm *.srt *.vtt);;All Files (*)"));
 
     if (!filePath.isEmpty()) {
+        // Documents in the same language pair share a translation memory
+        QString sourceLanguage, targetLanguage;
+        if (auto model = models_.getModelForPath(settings_.translationModel())) {
+            if (!model->srcTags.isEmpty())
+                sourceLanguage = model->srcTags.firstKey();
+            targetLanguage = model->trgTag;
+        }
+
         DocumentTranslationDialog *dialog = new DocumentTranslationDialog(
-            filePath, &settings_, translator_, this);
+            filePath, &settings_, translator_, sourceLanguage, targetLanguage, this);
         dialog->setAttribute(Qt::WA_DeleteOnClose);
         dialog->show();
     }
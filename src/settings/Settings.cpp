@@ -29,10 +29,19 @@ Settings::Settings(QObject *parent)
     "{c9cdf885-0431-4eed-8e18-967b1758c951}",
     "{2fa36771-561b-452c-b6c3-7486f42c25ae}"
 })
+, documentSegmentWords(backing_, "document_segment_words", 1000)
+, documentReuseTranslations(backing_, "document_reuse_translations", true)
+, documentTranslationMemory(backing_, "document_translation_memory", true)
+, documentFuzzyMatchPercent(backing_, "document_fuzzy_match_percent", 75)
 , llmEnabled(backing_, "llm_enabled", false)
 , llmProvider(backing_, "llm_provider", "Ollama")
 , llmUrl(backing_, "llm_url", "http://localhost:11434")
 , llmModel(backing_, "llm_model", "")
+, llmMaxConcurrent(backing_, "llm_max_concurrent", 0)
+, llmCache(backing_, "llm_cache", true)
+, llmCacheMegabytes(backing_, "llm_cache_mb", 64)
+, llmCacheDays(backing_, "llm_cache_days", 30)
+, llmRefineThreshold(backing_, "llm_refine_threshold", 0)
 , openaiApiKey(backing_, "openai_api_key", "")
 , claudeApiKey(backing_, "claude_api_key", "")
 , geminiApiKey(backing_, "gemini_api_key", "") {
@@ -109,11 +109,22 @@ public:
     SettingImpl<QMap<QString, translateLocally::Repository>> repos;
     SettingImpl<QSet<QString>> nativeMessagingClients;
 
+    // Document translation settings
+    SettingImpl<unsigned int> documentSegmentWords;
+    SettingImpl<bool> documentReuseTranslations; // Keep a manifest next to translated documents
+    SettingImpl<bool> documentTranslationMemory; // Share translations between documents per language pair
+    SettingImpl<unsigned int> documentFuzzyMatchPercent; // Least similarity reported as a fuzzy match
+
     // LLM/AI Settings
     SettingImpl<bool> llmEnabled;
     SettingImpl<QString> llmProvider;
     SettingImpl<QString> llmUrl;
     SettingImpl<QString> llmModel;
+    SettingImpl<unsigned int> llmMaxConcurrent; // Most requests in flight, 0 for the provider's default
+    SettingImpl<bool> llmCache; // Keep LLM answers on disk and reuse them for the same request
+    SettingImpl<unsigned int> llmCacheMegabytes; // 0 for no limit
+    SettingImpl<unsigned int> llmCacheDays; // How long an answer is reused, 0 for ever
+    SettingImpl<unsigned int> llmRefineThreshold; // Only refine sentences scoring below this percentage, 0 for all
     SettingImpl<QString> openaiApiKey;
     SettingImpl<QString> claudeApiKey;
     SettingImpl<QString> geminiApiKey;